@@ -81,6 +81,10 @@ void SaveConfig(char *name, void *ref, int mode) {
 	XMLUpdateNode(doc, root, force, "log_limit", "%d", (int32_t) glLogLimit);
 	XMLUpdateNode(doc, root, true, "migration", "%d", (int32_t) glMigration);
 	XMLUpdateNode(doc, root, force, "ports", glPortOpen);
+	XMLUpdateNode(doc, root, force, "cache_dir", glCacheDir);
+	XMLUpdateNode(doc, root, force, "cache_size", "%d", (int) glCacheSize);
+	XMLUpdateNode(doc, root, force, "cache_age", "%d", (int) glCacheAge);
+	XMLUpdateNode(doc, root, force, "metadata_cache_size", "%d", (int) glMetaCacheSize);
 
 	XMLUpdateNode(doc, common, force, "streambuf_size", "%d", (uint32_t) glDeviceParam.streambuf_size);
 	XMLUpdateNode(doc, common, force, "output_size", "%d", (uint32_t) glDeviceParam.outputbuf_size);
@@ -88,6 +92,7 @@ void SaveConfig(char *name, void *ref, int mode) {
 	XMLUpdateNode(doc, common, force, "codecs", glDeviceParam.codecs);
 	XMLUpdateNode(doc, common, force, "sample_rate", "%d", (int) glDeviceParam.sample_rate);
 	XMLUpdateNode(doc, common, force, "resolution", glDeviceParam.resolution);
+	XMLUpdateNode(doc, common, force, "adaptive_start", "%d", (int) glDeviceParam.adaptive_start);
 #if defined(RESAMPLE)
 	XMLUpdateNode(doc, common, force, "resample", "%d", (int) glDeviceParam.resample);
 	XMLUpdateNode(doc, common, force, "resample_options", glDeviceParam.resample_options);
@@ -113,8 +118,8 @@ void SaveConfig(char *name, void *ref, int mode) {
 	for (int i = 0; i < MAX_RENDERERS; i++) {
 		IXML_Node *dev_node;
 
-		if (!glMRDevices[i].Running) continue;
-		else p = &glMRDevices[i];
+		if (!glMRDevices[i] || !glMRDevices[i]->Running) continue;
+		else p = glMRDevices[i];
 
 		// existing device, keep param and update "name" if LMS has requested it
 		if (old_doc && ((dev_node = (IXML_Node*) FindMRConfig(old_doc, p->UDN)) != NULL)) {
@@ -180,6 +185,15 @@ static void LoadConfigItem(tMRConfig *Conf, sq_dev_param_t *sq_conf, char *name,
 	if (!strcmp(name, "name")) strcpy(sq_conf->name, val);
 	if (!strcmp(name, "server")) strcpy(sq_conf->server, val);
 	if (!strcmp(name, "resolution")) strcpy(sq_conf->resolution, val);
+	if (!strcmp(name, "adaptive_start")) {
+		long target = atol(val);
+		// a per-mille probability, anything else would break the start threshold
+		if (target < 0 || target > 999) {
+			LOG_WARN("adaptive_start %ld out of range (1..999), disabled", target);
+			target = 0;
+		}
+		sq_conf->adaptive_start = target;
+	}
 	if (!strcmp(name, "mac"))  {
 		unsigned mac[6];
 		// seems to be a Windows scanf buf, cannot support %hhx
@@ -226,6 +240,10 @@ static void LoadGlobalItem(char *name, char *val) {
 	if (!strcmp(name, "exclude_model")) strcpy(glExcluded, val);
 	if (!strcmp(name, "migration")) glMigration = atol(val);
 	if (!strcmp(name, "ports")) strcpy(glPortOpen, val);
+	if (!strcmp(name, "cache_dir")) strcpy(glCacheDir, val);
+	if (!strcmp(name, "cache_size")) glCacheSize = atol(val);
+	if (!strcmp(name, "cache_age")) glCacheAge = atol(val);
+	if (!strcmp(name, "metadata_cache_size")) glMetaCacheSize = atol(val);
  }
 
 
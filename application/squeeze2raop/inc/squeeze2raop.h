@@ -25,7 +25,8 @@
 /*----------------------------------------------------------------------------*/
 
 #define MAX_PROTO		128
-#define MAX_RENDERERS	32
+#define MAX_RENDERERS	256		// slots, devices are allocated on first use
+#define MR_BUCKETS		64
 #define MAGIC			0xAABBCCDD
 #define RESOURCE_LENGTH	250
 #define	SCAN_TIMEOUT 	15
@@ -38,8 +39,13 @@
 
 enum { CONFIG_CREATE, CONFIG_UPDATE, CONFIG_MIGRATE };
 
+#define RAOP_COMMANDS	16
+
+typedef enum { RAOP_CONNECT, RAOP_FLUSH, RAOP_OFF, RAOP_VOLUME, RAOP_ARTWORK } tRaopCmd;
+
 typedef struct sRaopReq {
-	char Type[20];
+	tRaopCmd Type;
+	bool Reconnect;			// FLUSH that a CONNECT was collapsed into
 	union sRaopReqData {
 		float Volume;
 		uint64_t FlushTS;
@@ -52,6 +58,12 @@ typedef struct sRaopReq {
 	} Data;
 } tRaopReq;
 
+// preallocated, pending commands are coalesced so remotes can't pile them up
+typedef struct sRaopQueue {
+	tRaopReq Slots[RAOP_COMMANDS];
+	int Head, Count;
+} tRaopQueue;
+
 typedef struct sMRConfig
 {
 	bool		Enabled;
@@ -73,6 +85,8 @@ typedef struct sMRConfig
 } tMRConfig;
 
 
+typedef enum { MR_UDN, MR_REMOTE, MR_MAC, MR_IP, MR_INDEXES } tMRIndex;
+
 struct sMR {
 	uint32_t Magic;
 	bool  Running;
@@ -97,7 +111,7 @@ struct sMR {
 	pthread_cond_t	Cond;
 	bool			Delete;
 	uint32_t		Busy;
-	cross_queue_t	Queue;
+	tRaopQueue		Queue;
 	uint32_t		LastFlush;
 	bool			DiscWait;
 	int				Sane;
@@ -112,14 +126,20 @@ struct sMR {
 	char ActiveRemote[16];
 	uint32_t SkipStart;
 	bool SkipDir;
+	uint32_t		IndexKey[MR_INDEXES];
+	struct sMR		*IndexNext[MR_INDEXES];
 };
 
 extern char 				glInterface[];
 extern int32_t				glLogLimit;
 extern tMRConfig			glMRConfig;
 extern sq_dev_param_t		glDeviceParam;
-extern struct sMR			glMRDevices[MAX_RENDERERS];
+extern struct sMR			*glMRDevices[MAX_RENDERERS];
 extern char					glExcluded[STR_LEN];
 extern int					glMigration;
 extern char					glPortOpen[STR_LEN];
+extern char					glCacheDir[STR_LEN];
+extern uint32_t				glCacheSize;
+extern uint32_t				glCacheAge;
+extern uint32_t				glMetaCacheSize;
 
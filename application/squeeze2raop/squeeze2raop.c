@@ -55,8 +55,12 @@ uint32_t			glNetmask;
 char 				glInterface[16] = "?";
 char				glExcluded[STR_LEN] = "aircast,airupnp,shairtunes2,airesp32";
 int					glMigration = 0;
-struct sMR			glMRDevices[MAX_RENDERERS];
+struct sMR			*glMRDevices[MAX_RENDERERS];
 char				glPortOpen[STR_LEN];
+char				glCacheDir[STR_LEN];
+uint32_t			glCacheSize = 0;	// MB, 0 = no cache
+uint32_t			glCacheAge = 0;		// minutes, 0 = only size matters
+uint32_t			glMetaCacheSize = 4;	// MB, metadata and artwork in memory
 
 log_level	slimproto_loglevel = lINFO;
 log_level	stream_loglevel = lWARN;
@@ -109,6 +113,7 @@ sq_dev_param_t glDeviceParam = {
 					{ 0x00,0x00,0x00,0x00,0x00,0x00 },	//mac
 					"",		//resolution
 					false,	// soft volume
+					0,		// adaptive start (per-mille underrun, 0 = off)
 #if defined(RESAMPLE)
 					96000,
 					true,
@@ -147,6 +152,10 @@ static struct in_addr 		glHost;
 static char					glModelName[STR_LEN] = MODEL_NAME_STRING;
 static uint16_t				glPortBase, glPortRange;
 static bool					glPairing, glPassword;
+static struct {
+	pthread_mutex_t	Mutex;
+	struct sMR		*Buckets[MR_INDEXES][MR_BUCKETS];
+} glIndex;
 
 static char usage[] =
 
@@ -236,6 +245,11 @@ static char license[] =
 static bool AddRaopDevice(struct sMR *Device, mdnssd_service_t *s);
 static void DelRaopDevice(struct sMR *Device);
 static bool IsExcluded(char *Model, char *Name);
+static void RaopQueueFree(void* item);
+static bool PushCommand(struct sMR *Device, tRaopCmd Type, union sRaopReqData *Data);
+static void FlushCommands(struct sMR *Device);
+static void StartArtwork(void);
+static void StopArtwork(void);
 
 #if BUSY_MODE
 static void BusyRaise(struct sMR *Device);
@@ -270,11 +284,7 @@ bool sq_callback(void *caller, sq_action_t action, ...)
 
 		if (!device->on) {
 			// flush everything in queue
-			tRaopReq *Req = malloc(sizeof(tRaopReq));
-			strcpy(Req->Type, "OFF");
-			queue_flush(&device->Queue);
-			queue_insert(&device->Queue, Req);
-			pthread_cond_signal(&device->Cond);
+			PushCommand(device, RAOP_OFF, NULL);
 		}
 
 		LOG_DEBUG("[%p]: device set on/off %d", caller, device->on);
@@ -295,45 +305,28 @@ bool sq_callback(void *caller, sq_action_t action, ...)
 			device->DiscWait = true;
 			device->TrackRunning = false;
 			break;
-		case SQ_STOP: {
-			tRaopReq *Req = malloc(sizeof(tRaopReq));
-
+		case SQ_STOP:
 			device->TrackRunning = false;
 			device->sqState = SQ_STOP;
 			// see note in raop_client.h why this 2-stages stop is needed
 			raopcl_stop(device->Raop);
-
-			strcpy(Req->Type, "FLUSH");
-			queue_insert(&device->Queue, Req);
-			pthread_cond_signal(&device->Cond);
+			PushCommand(device, RAOP_FLUSH, NULL);
 			break;
-		}
-		case SQ_PAUSE: {
-			tRaopReq *Req;
-
+		case SQ_PAUSE:
 			device->TrackRunning = false;
 			device->sqState = SQ_PAUSE;
 			// see note in raop_client.h why this 2-stages pause is needed
 			raopcl_pause(device->Raop);
-
-			Req = malloc(sizeof(tRaopReq));
-			strcpy(Req->Type, "FLUSH");
-			queue_insert(&device->Queue, Req);
-			pthread_cond_signal(&device->Cond);
+			PushCommand(device, RAOP_FLUSH, NULL);
 			break;
-		}
 		case SQ_UNPAUSE: {
-			tRaopReq *Req = malloc(sizeof(tRaopReq));
-
 			device->TrackRunning = true;
 			device->sqState = SQ_PLAY;
 			unsigned jiffies = va_arg(args, unsigned);
 			if (jiffies) 
 				raopcl_start_at(device->Raop, TIME_MS2NTP(jiffies) -
 								TS2NTP(raopcl_latency(device->Raop), raopcl_sample_rate(device->Raop)));
-			strcpy(Req->Type, "CONNECT");
-			queue_insert(&device->Queue, Req);
-			pthread_cond_signal(&device->Cond);
+			PushCommand(device, RAOP_CONNECT, NULL);
 			break;
 		}
 		case SQ_VOLUME: {
@@ -343,33 +336,26 @@ bool sq_callback(void *caller, sq_action_t action, ...)
 			if (device->Config.VolumeMode == VOLUME_HARD &&	now > device->VolumeStampRx + 1000 &&
 				(Volume || device->Config.MuteOnPause || sq_get_mode(device->SqueezeHandle) == device->sqState)) {
 				
+				union sRaopReqData Data = { .Volume = device->VolumeMapping[Volume] };
+
 				device->Volume = Volume;
-				
-				tRaopReq *Req = malloc(sizeof(tRaopReq));
-				Req->Data.Volume = device->VolumeMapping[(unsigned)device->Volume];
-				strcpy(Req->Type, "VOLUME");
-				queue_insert(&device->Queue, Req);
-				pthread_cond_signal(&device->Cond);
+				PushCommand(device, RAOP_VOLUME, &Data);
 			} else {
 				LOG_INFO("[%p]: volume ignored %u", device, Volume);
 			}
 
 			break;
 		}
-		case SQ_CONNECT: {
-			tRaopReq *Req = malloc(sizeof(tRaopReq));
-
+		case SQ_CONNECT:
 			device->sqState = SQ_PLAY;
-
-			strcpy(Req->Type, "CONNECT");
-			queue_insert(&device->Queue, Req);
-			pthread_cond_signal(&device->Cond);
-
+			PushCommand(device, RAOP_CONNECT, NULL);
 			break;
-		}
 		case SQ_METASEND:
 			device->MetadataWait = 5;
 			break;
+		case SQ_NEWMETADATA:
+			device->MetadataWait = 1;
+			break;
 		case SQ_STARTED:
 			device->TrackRunning = true;
 			device->MetadataWait = 2;
@@ -400,39 +386,382 @@ bool sq_callback(void *caller, sq_action_t action, ...)
 }
 
 /*----------------------------------------------------------------------------*/
-static void* GetArtworkThread(void *arg) {
-	union sRaopReqData* Data = &((tRaopReq*) arg)->Data;
+/* artwork is fetched by a small pool, keeping connections to LMS alive       */
+/*----------------------------------------------------------------------------*/
+#define ARTWORK_WORKERS		2
+#define ARTWORK_QUEUE		16
+#define ARTWORK_TIMEOUT		5000
+
+typedef struct sArtworkConn {
+	int Sock;
+	struct in_addr Host;
+	uint16_t Port;
+} tArtworkConn;
+
+static struct {
+	pthread_mutex_t Mutex;
+	pthread_cond_t Cond;
+	pthread_t Threads[ARTWORK_WORKERS];
+	bool Running;
+	tRaopReq *Queue[ARTWORK_QUEUE];
+	int Head, Count;
+} glArtwork;
+
+/*----------------------------------------------------------------------------*/
+static int ArtworkRecv(int Sock, char *Buf, int Len) {
+	struct timeval Timeout = { ARTWORK_TIMEOUT / 1000, (ARTWORK_TIMEOUT % 1000) * 1000 };
+	fd_set rfds;
+
+	FD_ZERO(&rfds);
+	FD_SET(Sock, &rfds);
+	if (select(Sock + 1, &rfds, NULL, NULL, &Timeout) <= 0) return -1;
+
+	return recv(Sock, Buf, Len, 0);
+}
+
+/*----------------------------------------------------------------------------*/
+static void ArtworkClose(tArtworkConn *Conn) {
+	if (Conn->Sock >= 0) closesocket(Conn->Sock);
+	Conn->Sock = -1;
+}
+
+/*----------------------------------------------------------------------------*/
+/* returns size, 0 on failure and -1 when it's for http_fetch to handle		  */
+static int ArtworkFetch(tArtworkConn *Conn, char *Url, char **ContentType, char **Image) {
+	char Host[64], Header[2048 + 1], *Path, *Body, *p;
+	struct in_addr Addr;
+	uint16_t Port = 80;
+	int Size, Len, Tries;
+
+	// only plain http to an address (which is what LMS gives)
+	if (strncasecmp(Url, "http://", 7) || (Path = strchr(Url + 7, '/')) == NULL || Path - Url - 7 >= (int) sizeof(Host)) return -1;
+
+	sprintf(Host, "%.*s", (int) (Path - Url - 7), Url + 7);
+	if ((p = strchr(Host, ':')) != NULL) {
+		Port = atoi(p + 1);
+		*p = '\0';
+	}
+	if ((Addr.s_addr = inet_addr(Host)) == INADDR_NONE) return -1;
+
+	// a kept connection might have been closed by server meanwhile, so retry once
+	for (Tries = 2; Tries--;) {
+		bool Reused = Conn->Sock >= 0 && Conn->Host.s_addr == Addr.s_addr && Conn->Port == Port;
+
+		if (!Reused) {
+			struct sockaddr_in addr;
+
+			ArtworkClose(Conn);
+			memset(&addr, 0, sizeof(addr));
+			addr.sin_family = AF_INET;
+			addr.sin_addr = Addr;
+			addr.sin_port = htons(Port);
+
+			Conn->Sock = socket(AF_INET, SOCK_STREAM, 0);
+			// http_fetch would just wait on the same unreachable host
+			if (tcp_connect_timeout(Conn->Sock, addr, ARTWORK_TIMEOUT)) {
+				ArtworkClose(Conn);
+				return 0;
+			}
+
+			Conn->Host = Addr;
+			Conn->Port = Port;
+		}
+
+		Len = snprintf(Header, sizeof(Header), "GET %s HTTP/1.1\r\nHost: %s:%hu\r\nConnection: keep-alive\r\n\r\n", Path, Host, Port);
+		if (Len < 0 || Len >= (int) sizeof(Header)) return -1;
+		if (send(Conn->Sock, Header, Len, 0) != Len) {
+			ArtworkClose(Conn);
+			if (Reused) continue;
+			return 0;
+		}
+
+		// read headers, body might come with them
+		for (Len = 0, Body = NULL; !Body && Len < (int) sizeof(Header) - 1; Len += Size) {
+			if ((Size = ArtworkRecv(Conn->Sock, Header + Len, sizeof(Header) - 1 - Len)) <= 0) break;
+			Header[Len + Size] = '\0';
+			if ((Body = strstr(Header, "\r\n\r\n")) != NULL) Body += 4;
+		}
+
+		if (Body || Len || !Reused) break;
+		ArtworkClose(Conn);
+	}
+
+	if (!Body) {
+		ArtworkClose(Conn);
+		return 0;
+	}
+
+	// anything else than a simple answer (redirect, chunked...) is not for us
+	if (!strstr(Header, " 200 ") || (p = strcasestr(Header, "\r\nContent-Length:")) == NULL || (Size = atoi(p + 17)) <= 0) {
+		ArtworkClose(Conn);
+		return -1;
+	}
+
+	// can't be larger than what the cache holds
+	if ((uint64_t) Size > (uint64_t) max(glMetaCacheSize, 1) * 1024 * 1024) {
+		LOG_WARN("[%p]: artwork too large (%d bytes) %s", Conn, Size, Url);
+		ArtworkClose(Conn);
+		return 0;
+	}
+
+	if ((p = strcasestr(Header, "\r\nContent-Type:")) != NULL) {
+		size_t n;
+
+		for (p += 15; *p == ' '; p++);
+		n = strcspn(p, "\r");
+		*ContentType = malloc(n + 1);
+		sprintf(*ContentType, "%.*s", (int) n, p);
+	}
+
+	*Image = malloc(Size);
+	Len -= Body - Header;
+	if (Len > Size) Len = Size;
+	memcpy(*Image, Body, Len);
+
+	while (Len < Size) {
+		int n = ArtworkRecv(Conn->Sock, *Image + Len, Size - Len);
+		if (n <= 0) break;
+		Len += n;
+	}
+
+	if (Len < Size || strcasestr(Header, "\r\nConnection: close")) ArtworkClose(Conn);
+
+	if (Len < Size) {
+		NFREE(*ContentType);
+		NFREE(*Image);
+		return 0;
+	}
+
+	return Size;
+}
+
+/*----------------------------------------------------------------------------*/
+static void GetArtwork(tArtworkConn *Conn, tRaopReq *Req) {
+	union sRaopReqData* Data = &Req->Data;
 	struct sMR* Device = Data->Artwork.Device;
+	bool Current;
+
+	// title might have changed while waiting
+	pthread_mutex_lock(&Device->Mutex);
+	Current = Device->Running && Device->MetadataHash == Data->Artwork.Hash;
+	pthread_mutex_unlock(&Device->Mutex);
+
+	if (!Current) {
+		LOG_DEBUG("[%p]: artwork not needed anymore %s", Device, Data->Artwork.Url);
+		RaopQueueFree(Req);
+		return;
+	}
+
+	// another player might have got it meanwhile
+	Data->Artwork.Size = artwork_cache_get(Data->Artwork.Url, &Data->Artwork.ContentType, &Data->Artwork.Image);
 
 	// try to get the image, might take a while
-	Data->Artwork.Size = http_fetch(Data->Artwork.Url, &Data->Artwork.ContentType, &Data->Artwork.Image);
+	if (!Data->Artwork.Size) {
+		Data->Artwork.Size = ArtworkFetch(Conn, Data->Artwork.Url, &Data->Artwork.ContentType, &Data->Artwork.Image);
+		if (Data->Artwork.Size < 0) Data->Artwork.Size = http_fetch(Data->Artwork.Url, &Data->Artwork.ContentType, &Data->Artwork.Image);
+		if (Data->Artwork.Size > 0) artwork_cache_put(Data->Artwork.Url, Data->Artwork.ContentType, Data->Artwork.Image, Data->Artwork.Size);
+	}
+
 	pthread_mutex_lock(&Device->Mutex);
 
 	// need to make sure we have artwork, that device is active and this si the right query
 	if (Data->Artwork.Size > 0 && Device->Running && Device->MetadataHash == Data->Artwork.Hash) {
-		queue_insert(&Device->Queue, arg);
-		pthread_cond_signal(&Device->Cond);
+		PushCommand(Device, RAOP_ARTWORK, Data);
+		free(Req);
 	} else {
 		LOG_WARN("[%p]: Can't get artwork or device not active %s", Device, Data->Artwork.Url);
-		NFREE(Data->Artwork.ContentType);
-		NFREE(Data->Artwork.Image);
-		free(Data->Artwork.Url);
-		free(arg);
+		RaopQueueFree(Req);
 	}
 
 	pthread_mutex_unlock(&Device->Mutex);
+}
+
+/*----------------------------------------------------------------------------*/
+static void* ArtworkThread(void *arg) {
+	tArtworkConn Conn = { -1 };
+
+	pthread_mutex_lock(&glArtwork.Mutex);
+
+	while (glArtwork.Running) {
+		tRaopReq *Req;
+
+		if (!glArtwork.Count) {
+			pthread_cond_wait(&glArtwork.Cond, &glArtwork.Mutex);
+			continue;
+		}
+
+		Req = glArtwork.Queue[glArtwork.Head];
+		glArtwork.Head = (glArtwork.Head + 1) % ARTWORK_QUEUE;
+		glArtwork.Count--;
+
+		pthread_mutex_unlock(&glArtwork.Mutex);
+		GetArtwork(&Conn, Req);
+		pthread_mutex_lock(&glArtwork.Mutex);
+	}
+
+	pthread_mutex_unlock(&glArtwork.Mutex);
+
+	ArtworkClose(&Conn);
 	return NULL;
 }
 
 /*----------------------------------------------------------------------------*/
-static void* GetRequest(cross_queue_t* Queue, pthread_mutex_t* Mutex, pthread_cond_t* Cond, uint32_t timeout) {
-	pthread_mutex_lock(Mutex);
+static void QueueArtwork(tRaopReq *Req) {
+	pthread_mutex_lock(&glArtwork.Mutex);
+
+	// a newer title supersedes what this player was still waiting for
+	for (int i = 0; Req && i < glArtwork.Count; i++) {
+		tRaopReq **Queued = glArtwork.Queue + (glArtwork.Head + i) % ARTWORK_QUEUE;
+
+		if ((*Queued)->Data.Artwork.Device == Req->Data.Artwork.Device) {
+			RaopQueueFree(*Queued);
+			*Queued = Req;
+			Req = NULL;
+		}
+	}
+
+	if (Req) {
+		// when full, the oldest request is the most likely to be stale
+		if (glArtwork.Count == ARTWORK_QUEUE) {
+			LOG_WARN("[%p]: artwork queue full, dropping %s", Req->Data.Artwork.Device, glArtwork.Queue[glArtwork.Head]->Data.Artwork.Url);
+			RaopQueueFree(glArtwork.Queue[glArtwork.Head]);
+			glArtwork.Head = (glArtwork.Head + 1) % ARTWORK_QUEUE;
+			glArtwork.Count--;
+		}
+
+		glArtwork.Queue[(glArtwork.Head + glArtwork.Count++) % ARTWORK_QUEUE] = Req;
+		pthread_cond_signal(&glArtwork.Cond);
+	}
+
+	pthread_mutex_unlock(&glArtwork.Mutex);
+}
+
+/*----------------------------------------------------------------------------*/
+static void StartArtwork(void) {
+	pthread_mutex_init(&glArtwork.Mutex, 0);
+	pthread_cond_init(&glArtwork.Cond, 0);
+	glArtwork.Head = glArtwork.Count = 0;
+	glArtwork.Running = true;
+
+	for (int i = 0; i < ARTWORK_WORKERS; i++) pthread_create(&glArtwork.Threads[i], NULL, &ArtworkThread, NULL);
+}
+
+/*----------------------------------------------------------------------------*/
+static void StopArtwork(void) {
+	pthread_mutex_lock(&glArtwork.Mutex);
+	glArtwork.Running = false;
+	pthread_cond_broadcast(&glArtwork.Cond);
+	pthread_mutex_unlock(&glArtwork.Mutex);
+
+	for (int i = 0; i < ARTWORK_WORKERS; i++) pthread_join(glArtwork.Threads[i], NULL);
+
+	while (glArtwork.Count) {
+		RaopQueueFree(glArtwork.Queue[glArtwork.Head]);
+		glArtwork.Head = (glArtwork.Head + 1) % ARTWORK_QUEUE;
+		glArtwork.Count--;
+	}
+
+	pthread_mutex_destroy(&glArtwork.Mutex);
+	pthread_cond_destroy(&glArtwork.Cond);
+}
+
+/*----------------------------------------------------------------------------*/
+static void RaopReqClear(tRaopReq *Req) {
+	if (Req->Type != RAOP_ARTWORK) return;
+	NFREE(Req->Data.Artwork.ContentType);
+	NFREE(Req->Data.Artwork.Image);
+	NFREE(Req->Data.Artwork.Url);
+}
+
+/*----------------------------------------------------------------------------*/
+static tRaopReq *QueueSlot(tRaopQueue *Queue, int i) {
+	return Queue->Slots + (Queue->Head + i) % RAOP_COMMANDS;
+}
+
+/*----------------------------------------------------------------------------*/
+static void FlushCommands(struct sMR *Device) {
+	tRaopQueue *Queue = &Device->Queue;
+
+	for (; Queue->Count; Queue->Count--) {
+		RaopReqClear(QueueSlot(Queue, 0));
+		Queue->Head = (Queue->Head + 1) % RAOP_COMMANDS;
+	}
+}
+
+/*----------------------------------------------------------------------------*/
+/* Device's mutex must be locked, queue owns Data (even if command is dropped) */
+static bool PushCommand(struct sMR *Device, tRaopCmd Type, union sRaopReqData *Data) {
+	tRaopQueue *Queue = &Device->Queue;
+	tRaopReq *Req, *Last = Queue->Count ? QueueSlot(Queue, Queue->Count - 1) : NULL;
+
+	switch (Type) {
+	case RAOP_OFF:
+		// nothing else matters
+		FlushCommands(Device);
+		break;
+	case RAOP_FLUSH:
+		// flush, connect, flush is just a flush
+		if (Last && Last->Type == RAOP_FLUSH) {
+			Last->Reconnect = false;
+			return true;
+		}
+		break;
+	case RAOP_CONNECT:
+		// a pause/unpause burst becomes a single command
+		if (Last && Last->Type == RAOP_FLUSH) {
+			Last->Reconnect = true;
+			return true;
+		}
+		if (Last && (Last->Type == RAOP_CONNECT || Last->Reconnect)) return true;
+		break;
+	case RAOP_VOLUME:
+	case RAOP_ARTWORK:
+		// only the latest one matters, but it must stay after what was queued before it
+		for (int i = 0; i < Queue->Count; i++) {
+			if (QueueSlot(Queue, i)->Type != Type) continue;
+			RaopReqClear(QueueSlot(Queue, i));
+			for (Queue->Count--; i < Queue->Count; i++) *QueueSlot(Queue, i) = *QueueSlot(Queue, i + 1);
+			break;
+		}
+		break;
+	}
+
+	if (Queue->Count == RAOP_COMMANDS) {
+		tRaopReq Dropped = { Type };
+
+		LOG_WARN("[%p]: command queue full, dropping %d", Device, Type);
+		if (Data) Dropped.Data = *Data;
+		RaopReqClear(&Dropped);
+		return false;
+	}
+
+	Req = QueueSlot(Queue, Queue->Count++);
+	memset(Req, 0, sizeof(tRaopReq));
+	Req->Type = Type;
+	if (Data) Req->Data = *Data;
+
+	pthread_cond_signal(&Device->Cond);
+	return true;
+}
+
+/*----------------------------------------------------------------------------*/
+static bool PopCommand(struct sMR *Device, tRaopReq *Req, uint32_t timeout) {
+	tRaopQueue *Queue = &Device->Queue;
+	bool Found = false;
+
+	pthread_mutex_lock(&Device->Mutex);
 
-	void* data = queue_extract(Queue);
-	if (!data) pthread_cond_reltimedwait(Cond, Mutex, timeout);
+	if (Queue->Count) {
+		*Req = *QueueSlot(Queue, 0);
+		Queue->Head = (Queue->Head + 1) % RAOP_COMMANDS;
+		Queue->Count--;
+		Found = true;
+	} else {
+		pthread_cond_reltimedwait(&Device->Cond, &Device->Mutex, timeout);
+	}
 
-	pthread_mutex_unlock(Mutex);
-	return data;
+	pthread_mutex_unlock(&Device->Mutex);
+	return Found;
 }
 
 /*----------------------------------------------------------------------------*/
@@ -450,7 +779,8 @@ static void *PlayerThread(void *args) {
 
 	while (Device->Running) {
 		// context is valid until this thread ends, no deletion issue
-		tRaopReq *req = GetRequest(&Device->Queue, &Device->Mutex, &Device->Cond, 1000);
+		tRaopReq Req;
+		bool Got = PopCommand(Device, &Req, 1000);
 		uint32_t now = gettime_ms();
 
 		// player is not ready to receive commands
@@ -460,8 +790,13 @@ static void *PlayerThread(void *args) {
 			if (now > Last + 5000) {
 				LOG_WARN("[%p]: Player has been in 'PreventPlayback' for too long");
 				sq_notify(Device->SqueezeHandle, SQ_OFF);
-			} else if (req) {
-				queue_insert_first(&Device->Queue, req);
+			} else if (Got && Device->Queue.Count < RAOP_COMMANDS) {
+				// put it back first
+				Device->Queue.Head = (Device->Queue.Head + RAOP_COMMANDS - 1) % RAOP_COMMANDS;
+				Device->Queue.Slots[Device->Queue.Head] = Req;
+				Device->Queue.Count++;
+			} else if (Got) {
+				RaopReqClear(&Req);
 			}
 
 			pthread_mutex_unlock(&Device->Mutex);
@@ -474,7 +809,7 @@ static void *PlayerThread(void *args) {
 		Last = now;
 
 		// empty means timeout every sec
-		if (!req) {
+		if (!Got) {
 			LOG_DEBUG("[%p]: tick %u", Device, now);
 
 			if (Device->DiscWait && (Device->LastFlush + (Device->Config.IdleTimeout * 1000) - now > 1000) ) {
@@ -511,6 +846,8 @@ static void *PlayerThread(void *args) {
 
 				// set progress at every metadata check (for live streams)
 				Time = sq_get_time(Device->SqueezeHandle);
+				// cached position might still be the previous track's
+				if (metadata.duration && Time > metadata.duration) Time = metadata.duration;
 				raopcl_set_progress_ms(Device->Raop, Time, metadata.duration);
 
 				hash = hash32(metadata.title) ^ hash32(metadata.artwork);
@@ -524,28 +861,36 @@ static void *PlayerThread(void *args) {
 
 					Device->MetadataHash = hash;
 
-					// only get coverart if title has changed
+					// only get coverart if title has changed, other players might have it already
 					if (metadata.artwork && Device->Config.SendCoverArt) {
-						tRaopReq* Req = calloc(1, sizeof(tRaopReq));
-						strcpy(Req->Type, "ARTWORK");
-						Req->Data.Artwork.Url = strdup(metadata.artwork);
-						Req->Data.Artwork.Device = Device;
-						Req->Data.Artwork.Hash = hash;
-
-						pthread_t lambda;
-						pthread_create(&lambda, NULL, &GetArtworkThread, Req);
-						pthread_detach(lambda);
+						char *ContentType, *Image;
+						int Size = artwork_cache_get(metadata.artwork, &ContentType, &Image);
+
+						if (Size) {
+							LOG_INFO("[%p]: cached artwork for %s", Device, metadata.artwork);
+							raopcl_set_artwork(Device->Raop, ContentType, Size, Image);
+							NFREE(ContentType);
+							free(Image);
+						} else {
+							tRaopReq* Req = calloc(1, sizeof(tRaopReq));
+							Req->Type = RAOP_ARTWORK;
+							Req->Data.Artwork.Url = strdup(metadata.artwork);
+							Req->Data.Artwork.Device = Device;
+							Req->Data.Artwork.Hash = hash;
+							QueueArtwork(Req);
+						}
 					}
 
 					/*
-					Set refresh rate to 5 sec for true live streams and song
-					duration + 5s for others that might be either live but with
-					real duration from plugin helpers or streaming services
+					Unless LMS notifies changes, set refresh rate to 5 sec for true
+					live streams and song duration + 5s for others that might be
+					either live but with real duration from plugin helpers or
+					streaming services
 					*/
-					if (metadata.remote) {
+					if (metadata.remote && !sq_subscribed(Device->SqueezeHandle)) {
 						Device->MetadataWait = 5;
 						if (metadata.duration) {
-							Device->MetadataWait += (metadata.duration - Time) / 1000;
+							Device->MetadataWait += min((metadata.duration - Time) / 1000, 250);
 						}
 					}
 
@@ -558,7 +903,7 @@ static void *PlayerThread(void *args) {
 								 metadata.artwork ? metadata.artwork : "");
 
 
-				} else Device->MetadataWait = 5;
+				} else if (!sq_subscribed(Device->SqueezeHandle)) Device->MetadataWait = 5;
 
 				metadata_free(&metadata);
 				LOG_DEBUG("[%p]: next metadata update %u", Device, Device->MetadataWait);
@@ -568,7 +913,15 @@ static void *PlayerThread(void *args) {
 			continue;
 		}
 
-		if (!strcasecmp(req->Type, "CONNECT")) {
+		switch (Req.Type) {
+		case RAOP_FLUSH:
+			LOG_INFO("[%p]: flushing ...", Device);
+			Device->LastFlush = gettime_ms();
+			Device->DiscWait = true;
+			raopcl_flush(Device->Raop);
+			if (!Req.Reconnect) break;
+			// fall through
+		case RAOP_CONNECT:
 			LOG_INFO("[%p]: raop connecting ...", Device);
 			if (raopcl_connect(Device->Raop, Device->PlayerIP, Device->PlayerPort, Device->Config.Volume != -1)) {
 				Device->DiscWait = false;
@@ -576,28 +929,18 @@ static void *PlayerThread(void *args) {
 			} else {
 				LOG_ERROR("[%p]: raop failed to connect", Device);
 			}
-		}
-
-		if (!strcasecmp(req->Type, "FLUSH")) {
-			LOG_INFO("[%p]: flushing ...", Device);
-			Device->LastFlush = gettime_ms();
-			Device->DiscWait = true;
-			raopcl_flush(Device->Raop);
-		}
-
-		if (!strcasecmp(req->Type, "OFF")) {
+			break;
+		case RAOP_OFF:
 			LOG_INFO("[%p]: processing off", Device);
 			raopcl_disconnect(Device->Raop);
 			raopcl_sanitize(Device->Raop);
-		}
-
-		if (!strcasecmp(req->Type, "VOLUME")) {
-			LOG_INFO("[%p]: processing volume device:%d request:%.2f", Device, Device->Volume, req->Data.Volume);
-			raopcl_set_volume(Device->Raop, req->Data.Volume);
-		}
-
-		if (!strcasecmp(req->Type, "ARTWORK")) {
-			union sRaopReqData* Data = &((tRaopReq*)req)->Data;
+			break;
+		case RAOP_VOLUME:
+			LOG_INFO("[%p]: processing volume device:%d request:%.2f", Device, Device->Volume, Req.Data.Volume);
+			raopcl_set_volume(Device->Raop, Req.Data.Volume);
+			break;
+		case RAOP_ARTWORK: {
+			union sRaopReqData* Data = &Req.Data;
 			LOG_INFO("[%p]: Got artwork for %s", Device, Data->Artwork.Url);
 
 			// need to make sure this is *really* for us
@@ -606,13 +949,11 @@ static void *PlayerThread(void *args) {
 			} else {
 				LOG_WARN("[%p]: Wrong artwork", Device);
 			}
-
-			NFREE(Data->Artwork.ContentType);
-			NFREE(Data->Artwork.Image);
-			free(Data->Artwork.Url);
+			break;
+		}
 		}
 
-		free(req);
+		RaopReqClear(&Req);
 	}
 
 	return NULL;
@@ -624,10 +965,80 @@ static char *GetmDNSAttribute(mdnssd_txt_attr_t *p, int count, char *name) {
 	return NULL;
 }
 
+/*----------------------------------------------------------------------------*/
+static uint32_t IndexKey(struct sMR *Device, tMRIndex Index) {
+	switch (Index) {
+	case MR_UDN: return hash32(Device->UDN);
+	case MR_REMOTE: return hash32(Device->ActiveRemote);
+	case MR_MAC: return *(uint32_t*)(Device->sq_config.mac + 2) ^ *(uint16_t*)Device->sq_config.mac;
+	case MR_IP: return Device->PlayerIP.s_addr;
+	default: return 0;
+	}
+}
+
+/*----------------------------------------------------------------------------*/
+static void _IndexLink(struct sMR *Device, tMRIndex Index) {
+	struct sMR **bucket;
+
+	Device->IndexKey[Index] = IndexKey(Device, Index);
+	bucket = &glIndex.Buckets[Index][Device->IndexKey[Index] % MR_BUCKETS];
+	Device->IndexNext[Index] = *bucket;
+	*bucket = Device;
+}
+
+/*----------------------------------------------------------------------------*/
+static void _IndexUnlink(struct sMR *Device, tMRIndex Index) {
+	struct sMR **p = &glIndex.Buckets[Index][Device->IndexKey[Index] % MR_BUCKETS];
+
+	for (; *p && *p != Device; p = &(*p)->IndexNext[Index]);
+	if (*p) *p = Device->IndexNext[Index];
+	Device->IndexNext[Index] = NULL;
+}
+
+/*----------------------------------------------------------------------------*/
+static void IndexDevice(struct sMR *Device) {
+	pthread_mutex_lock(&glIndex.Mutex);
+	for (int i = 0; i < MR_INDEXES; i++) _IndexLink(Device, i);
+	pthread_mutex_unlock(&glIndex.Mutex);
+}
+
+/*----------------------------------------------------------------------------*/
+static void UnindexDevice(struct sMR *Device) {
+	pthread_mutex_lock(&glIndex.Mutex);
+	for (int i = 0; i < MR_INDEXES; i++) _IndexUnlink(Device, i);
+	pthread_mutex_unlock(&glIndex.Mutex);
+}
+
+/*----------------------------------------------------------------------------*/
+static void ReindexDevice(struct sMR *Device, tMRIndex Index) {
+	pthread_mutex_lock(&glIndex.Mutex);
+	_IndexUnlink(Device, Index);
+	_IndexLink(Device, Index);
+	pthread_mutex_unlock(&glIndex.Mutex);
+}
+
+/*----------------------------------------------------------------------------*/
+static struct sMR *SearchIndex(tMRIndex Index, uint32_t Key, const void *Value, struct sMR *Exclude) {
+	struct sMR *p;
+
+	pthread_mutex_lock(&glIndex.Mutex);
+
+	// key is only a hash, so confirm with the actual value
+	for (p = glIndex.Buckets[Index][Key % MR_BUCKETS]; p; p = p->IndexNext[Index]) {
+		if (!p->Running || p == Exclude || p->IndexKey[Index] != Key) continue;
+		if (Index == MR_UDN && !strcmp(p->UDN, Value)) break;
+		if (Index == MR_REMOTE && !strcmp(p->ActiveRemote, Value)) break;
+		if (Index == MR_MAC && !memcmp(p->sq_config.mac, Value, 6)) break;
+		if (Index == MR_IP && p->PlayerIP.s_addr == ((struct in_addr*) Value)->s_addr) break;
+	}
+
+	pthread_mutex_unlock(&glIndex.Mutex);
+	return p;
+}
+
 /*----------------------------------------------------------------------------*/
 static struct sMR *SearchUDN(char *UDN) {
-	for (int i = 0; i < MAX_RENDERERS; i++) if (glMRDevices[i].Running && !strcmp(glMRDevices[i].UDN, UDN))	return glMRDevices + i;
-	return NULL;
+	return SearchIndex(MR_UDN, hash32(UDN), UDN, NULL);
 }
 
 /*----------------------------------------------------------------------------*/
@@ -638,8 +1049,8 @@ static void UpdateDevices() {
 
 	// walk through the list for device whose timeout expired
 	for (int i = 0; i < MAX_RENDERERS; i++) {
-		struct sMR* Device = glMRDevices + i;
-		if (!Device->Running || Device->Config.RemoveTimeout <= 0 || !Device->Expired || 
+		struct sMR* Device = glMRDevices[i];
+		if (!Device || !Device->Running || Device->Config.RemoveTimeout <= 0 || !Device->Expired || 
 			now < Device->Expired + Device->Config.RemoveTimeout * 1000) continue;
 
 		if (!ping_host(Device->PlayerIP, 100)) {
@@ -688,6 +1099,7 @@ static bool mDNSsearchCallback(mdnssd_service_t *slist, void *cookie, bool *stop
 				LOG_INFO("[%p]: changed ip:port %s:%d", Device, inet_ntoa(s->addr), s->port);
 				Device->PlayerPort = s->port;
 				Device->PlayerIP = s->addr;
+				ReindexDevice(Device, MR_IP);
 
 				// replace ip:port piece of credentials
 				if (*Device->Config.Credentials) {
@@ -710,15 +1122,24 @@ static bool mDNSsearchCallback(mdnssd_service_t *slist, void *cookie, bool *stop
 			continue;
 		}
 
-		// device creation so search a free spot.
-		for (Device = glMRDevices; Device->Running && Device < glMRDevices + MAX_RENDERERS; Device++);
+		// device creation so search a free spot, slots are only allocated once and then recycled
+		int i;
+		for (i = 0; i < MAX_RENDERERS && glMRDevices[i] && glMRDevices[i]->Running; i++);
 
 		// no more room !
-		if (Device == glMRDevices + MAX_RENDERERS) {
+		if (i == MAX_RENDERERS) {
 			LOG_ERROR("Too many devices (max:%u)", MAX_RENDERERS);
 			break;
 		}
 
+		if (!glMRDevices[i]) {
+			glMRDevices[i] = calloc(1, sizeof(struct sMR));
+			pthread_mutex_init(&glMRDevices[i]->Mutex, 0);
+			pthread_cond_init(&glMRDevices[i]->Cond, 0);
+		}
+
+		Device = glMRDevices[i];
+
 		if (AddRaopDevice(Device, s) && !glDiscovery) {
 			// create a new slimdevice
 			Device->sq_config.soft_volume = (Device->Config.VolumeMode == VOLUME_SOFT);
@@ -825,13 +1246,8 @@ static void SetVolumeMapping(struct sMR *Device) {
 
 /*----------------------------------------------------------------------------*/
 static void RaopQueueFree(void* item) {
-	tRaopReq* p = item;
-	if (strcasestr(p->Type, "ARTWORK")) {
-		NFREE(p->Data.Artwork.ContentType);
-		NFREE(p->Data.Artwork.Image);
-		free(p->Data.Artwork.Url);
-	}
-	free(p);
+	RaopReqClear(item);
+	free(item);
 }
 
 /*----------------------------------------------------------------------------*/
@@ -915,14 +1331,14 @@ static bool AddRaopDevice(struct sMR *Device, mdnssd_service_t *s) {
 	}
 
 	// virtual players duplicate mac address
-	for (int i = 0; i < MAX_RENDERERS; i++) {
-		if (glMRDevices[i].Running && Device != glMRDevices + i && !memcmp(glMRDevices[i].sq_config.mac, Device->sq_config.mac, 6)) {
-			memset(Device->sq_config.mac, 0xaa, 2);
-			*(uint32_t*)(Device->sq_config.mac + 2) = hash32(Device->UDN);
-			LOG_INFO("[%p]: duplicated mac ... updating", Device);
-		}
+	if (SearchIndex(MR_MAC, IndexKey(Device, MR_MAC), Device->sq_config.mac, Device)) {
+		memset(Device->sq_config.mac, 0xaa, 2);
+		*(uint32_t*)(Device->sq_config.mac + 2) = hash32(Device->UDN);
+		LOG_INFO("[%p]: duplicated mac ... updating", Device);
 	}
 
+	IndexDevice(Device);
+
 	LOG_INFO("[%p]: adding renderer (%s@%s) with mac %hX-%X", Device, Device->FriendlyName, inet_ntoa(Device->PlayerIP),  
 	         *(uint16_t*)Device->sq_config.mac, *(uint32_t*)(Device->sq_config.mac + 2));
 
@@ -990,8 +1406,8 @@ static bool AddRaopDevice(struct sMR *Device, mdnssd_service_t *s) {
 /*----------------------------------------------------------------------------*/
 static void FlushRaopDevices(void) {
 	for (int i = 0; i < MAX_RENDERERS; i++) {
-		struct sMR *p = &glMRDevices[i];
-		if (p->Running) DelRaopDevice(p);
+		struct sMR *p = glMRDevices[i];
+		if (p && p->Running) DelRaopDevice(p);
 	}
 }
 
@@ -1003,7 +1419,8 @@ static void DelRaopDevice(struct sMR *Device) {
 	pthread_mutex_unlock(&Device->Mutex);
 	pthread_join(Device->Thread, NULL);
 	raopcl_destroy(Device->Raop);
-	queue_flush(&Device->Queue);
+	FlushCommands(Device);
+	UnindexDevice(Device);
 
 	LOG_INFO("[%p]: Raop device stopped", Device);
 
@@ -1030,8 +1447,8 @@ static void *ActiveRemoteThread(void *args) {
 	}
 
 	while (glMainRunning) {
-		int sd, i;
-		struct sockaddr cli_addr;
+		int sd;
+		struct sockaddr_in cli_addr;
 		socklen_t clilen = sizeof(cli_addr);
 		struct sMR *Device = NULL;
 		char *p;
@@ -1060,6 +1477,7 @@ static void *ActiveRemoteThread(void *args) {
 		LOG_INFO("raw active remote: %s", buf);
 
 		// a pretty basic reading of command
+		*ActiveRemote = '\0';
 		p = strstr(buf, "active-remote:");
 		if (p) sscanf(p, "active-remote:%15s", ActiveRemote);
 		ActiveRemote[sizeof(ActiveRemote) - 1] = '\0';
@@ -1067,13 +1485,9 @@ static void *ActiveRemoteThread(void *args) {
 		if (p) sscanf(p, "/ctrl-int/1/%127s", command);
 		command[sizeof(command) - 1] = '\0';
 
-		// find where this is coming from
-		for (i = 0; i < MAX_RENDERERS; i++) {
-			if (glMRDevices[i].Running && !strcmp(glMRDevices[i].ActiveRemote, ActiveRemote)) {
-				Device = &glMRDevices[i];
-				break;
-			}
-		}
+		// find where this is coming from, by its peer address if it did not say
+		if (*ActiveRemote) Device = SearchIndex(MR_REMOTE, hash32(ActiveRemote), ActiveRemote, NULL);
+		else Device = SearchIndex(MR_IP, cli_addr.sin_addr.s_addr, &cli_addr.sin_addr, NULL);
 
 		if (!Device) {
 			LOG_WARN("DACP from unknown player %s", buf);
@@ -1156,11 +1570,8 @@ static void *ActiveRemoteThread(void *args) {
 					sq_notify(Device->SqueezeHandle, SQ_VOLUME, vol);
 
 					// some players expect controller to update volume, it's a request not a notification	
-					tRaopReq* Req = malloc(sizeof(tRaopReq));
-					Req->Data.Volume = volume;
-					strcpy(Req->Type, "VOLUME");
-					queue_insert(&Device->Queue, Req);
-					pthread_cond_signal(&Device->Cond);
+					union sRaopReqData Data = { .Volume = volume };
+					PushCommand(Device, RAOP_VOLUME, &Data);
 				} 
 			}
 		}
@@ -1296,8 +1707,6 @@ void BusyDrop(struct sMR *Device) {
 
 /*----------------------------------------------------------------------------*/
 static bool Start(void) {
-	int i;
-
 	if (!cross_ssl_load()) {
 		LOG_ERROR("Cannot load SSL libraries", NULL);
 		return false;
@@ -1315,18 +1724,18 @@ static bool Start(void) {
 
 	if (glHost.s_addr == INADDR_NONE) return false;
 
+	// devices are allocated when discovered
 	memset(&glMRDevices, 0, sizeof(glMRDevices));
+	memset(&glIndex.Buckets, 0, sizeof(glIndex.Buckets));
 
 	pthread_mutex_init(&glMainMutex, 0);
 	pthread_cond_init(&glMainCond, 0);
-
-    for (i = 0; i < MAX_RENDERERS;  i++) {
-		pthread_mutex_init(&glMRDevices[i].Mutex, 0);
-		pthread_cond_init(&glMRDevices[i].Cond, 0);
-		queue_init(&glMRDevices[i].Queue, false, RaopQueueFree);
-	}
+	pthread_mutex_init(&glIndex.Mutex, 0);
 
 	sq_init(glHost, glModelName);
+	sq_cache_init(glCacheDir, glCacheSize, glCacheAge);
+	metadata_cache_init((size_t) glMetaCacheSize * 1024 * 1024);
+	StartArtwork();
 
 	/* start the mDNS devices discovery thread */
 	if ((glmDNSsearchHandle = mdnssd_init(false, glHost, true)) == NULL) {;
@@ -1367,15 +1776,23 @@ static bool Stop(void) {
 	pthread_mutex_destroy(&glMainMutex);
 	pthread_cond_destroy(&glMainCond);
 
+	LOG_INFO("terminate artwork workers ...", NULL);
+	StopArtwork();
+
 	for (int i = 0; i < MAX_RENDERERS;  i++) {
-		pthread_mutex_destroy(&glMRDevices[i].Mutex);
-		pthread_cond_destroy(&glMRDevices[i].Cond);
+		if (!glMRDevices[i]) continue;
+		pthread_mutex_destroy(&glMRDevices[i]->Mutex);
+		pthread_cond_destroy(&glMRDevices[i]->Cond);
+		NFREE(glMRDevices[i]);
 	}
 
+	pthread_mutex_destroy(&glIndex.Mutex);
+
 	if (glConfigID) ixmlDocument_free(glConfigID);
 
 	netsock_close();
 	cross_ssl_free();
+	metadata_cache_end();
 
 	return true;
 }
@@ -1604,8 +2021,8 @@ int main(int argc, char *argv[])
 		while (AppleTVpairing(NULL, &UDN, &secret)) {
 			if (!UDN || !secret) continue;
 			for (int i = 0; i < MAX_RENDERERS; i++) {
-				if (glMRDevices[i].Running && !strcasecmp(glMRDevices[i].UDN, UDN)) {
-					sprintf(glMRDevices[i].Config.Credentials, "%s@%s:%hu", secret, inet_ntoa(glMRDevices[i].PlayerIP), glMRDevices[i].PlayerPort);
+				if (glMRDevices[i] && glMRDevices[i]->Running && !strcasecmp(glMRDevices[i]->UDN, UDN)) {
+					sprintf(glMRDevices[i]->Config.Credentials, "%s@%s:%hu", secret, inet_ntoa(glMRDevices[i]->PlayerIP), glMRDevices[i]->PlayerPort);
 					SaveConfig(glConfigName, glConfigID, CONFIG_UPDATE);
 					break;
 				}
@@ -1631,19 +2048,19 @@ int main(int argc, char *argv[])
 			if (!UDN) continue;
 
 			for (int i = 0; i < MAX_RENDERERS; i++) {
-				if (glMRDevices[i].Running && !strcasecmp(glMRDevices[i].UDN, UDN)) {
-					*glMRDevices[i].Config.Password = '\0';
+				if (glMRDevices[i] && glMRDevices[i]->Running && !strcasecmp(glMRDevices[i]->UDN, UDN)) {
+					*glMRDevices[i]->Config.Password = '\0';
 					if (passwd && *passwd) {
 						char* encrypted;
 						size_t len = strlen(passwd);
 
 						// xor it with UDN
-						for (size_t j = len; j--; passwd[j] ^= glMRDevices[i].UDN[j]);
+						for (size_t j = len; j--; passwd[j] ^= glMRDevices[i]->UDN[j]);
 						base64_encode(passwd, len, &encrypted);
 
 						// remove trailing '='
 						for (char* p = encrypted + strlen(encrypted); *--p == '='; *p = '\0');
-						strcpy(glMRDevices[i].Config.Password, encrypted);
+						strcpy(glMRDevices[i]->Config.Password, encrypted);
 						free(encrypted);
 					}
 					SaveConfig(glConfigName, glConfigID, CONFIG_UPDATE);
@@ -1714,13 +2131,25 @@ int main(int argc, char *argv[])
 			SaveConfig(name, glConfigID, true);
 		}
 
+		if (!strcmp(resp, "cache"))	{
+			unsigned hits, misses;
+			size_t used;
+			int count;
+
+			sq_cache_stats(&hits, &misses, &used, &count);
+			printf("cache [h:%u] [m:%u] [n:%d] [%zu/%u MB]\n", hits, misses, count, used / (1024 * 1024), glCacheSize);
+		}
+
 		if (!strcmp(resp, "dump") || !strcmp(resp, "dumpall"))	{
 			uint32_t now = gettime_ms();
 			bool all = !strcmp(resp, "dumpall");
 
 			for (i = 0; i < MAX_RENDERERS; i++) {
-				struct sMR *p = &glMRDevices[i];
-				bool Locked = pthread_mutex_trylock(&p->Mutex);
+				struct sMR *p = glMRDevices[i];
+				bool Locked;
+
+				if (!p) continue;
+				Locked = pthread_mutex_trylock(&p->Mutex);
 
 				if (!Locked) pthread_mutex_unlock(&p->Mutex);
 				if (!p->Running && !all) continue;
@@ -110,8 +110,8 @@ void _buf_unwrap(struct buffer *buf, size_t cont) {
 	size_t size;
 	u8_t *scratch;
 
-	// do nothing if we have enough space
-	if (by <= 0 || cont >= buf->size) return;
+	// do nothing if we have enough space or if that's a (read-only) mapped file
+	if (by <= 0 || cont >= buf->size || !buf->base_size) return;
 
 	// buffer already unwrapped, just move it up
 	if (buf->writep >= buf->readp) {
@@ -0,0 +1,525 @@
+/*
+ *  Squeezelite - lightweight headless squeezebox emulator
+ *
+ *  (c) Philippe, philippe_44@outlook.com
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+// disk cache of streamed tracks, shared by all players
+
+#include "squeezelite.h"
+
+#if !WIN
+#include <fcntl.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#endif
+
+extern log_level	stream_loglevel;
+static log_level 	*loglevel = &stream_loglevel;
+
+#define CACHE_BACKLOG	(4*1024*1024)	// bytes waiting for disk before recordings are dropped
+
+#if !WIN
+// a track being recorded, the writer thread opens, fills and commits it
+struct cache_rec {
+	u64_t key;
+	int fd;
+	bool failed, dropped;
+	char *header;
+	size_t header_len;
+	struct cache_job *end;		// commit or abort, preallocated so they can't fail
+};
+
+struct cache_job {
+	struct cache_job *next;
+	enum { CACHE_OPEN, CACHE_WRITE, CACHE_COMMIT, CACHE_ABORT } type;
+	struct cache_rec *rec;
+	size_t len;					// data bytes or, for commit, full size
+	u8_t data[];
+};
+#endif
+
+static struct {
+	mutex_type mutex;
+	char dir[STR_LEN];
+	size_t size, used;			// bytes
+	u32_t age;					// ms, 0 to keep until size requires
+	u32_t hits, misses;
+	int count, max;
+	struct cache_entry {
+		u64_t key;
+		size_t size;
+		u32_t last;
+		char *header;
+		size_t header_len;
+	} *items;
+#if !WIN
+	// disk writes are done here, not by the stream reactor
+	thread_type thread;
+	pthread_cond_t cond;
+	bool running;
+	struct cache_job *jobs, *last;
+	size_t backlog;
+#endif
+} cache;
+
+#if !WIN
+/*---------------------------------------------------------------------------*/
+static void _cache_name(char *name, u64_t key, const char *suffix) {
+	sprintf(name, "%s/%016" PRIx64 "%s", cache.dir, key, suffix);
+}
+
+/*---------------------------------------------------------------------------*/
+static void _cache_tmp(char *name, struct cache_rec *rec) {
+	sprintf(name, "%s/%016" PRIx64 "-%p.tmp", cache.dir, rec->key, (void*) rec);
+}
+
+/*---------------------------------------------------------------------------*/
+static bool _cache_owned(const char *name) {
+	size_t len = strlen(name);
+
+	// only what we could have written: 16 hex digits then ".cache" or "-<pointer>.tmp"
+	if (strspn(name, "0123456789abcdef") != 16) return false;
+	if (!strcmp(name + 16, ".cache")) return true;
+
+	return len > 16 + 1 + 4 && name[16] == '-' && !strcmp(name + len - 4, ".tmp") &&
+		   strspn(name + 17, "0123456789abcdefx") == len - 17 - 4;
+}
+
+/*---------------------------------------------------------------------------*/
+static void _cache_drop(int i) {
+	cache.used -= cache.items[i].size;
+	free(cache.items[i].header);
+	cache.items[i] = cache.items[--cache.count];
+}
+
+/*---------------------------------------------------------------------------*/
+static void _cache_remove(int i) {
+	char name[STR_LEN + 32];
+
+	_cache_name(name, cache.items[i].key, ".cache");
+	unlink(name);
+	_cache_drop(i);
+}
+
+/*---------------------------------------------------------------------------*/
+static int _cache_evict(size_t room, u64_t *evicted) {
+	u32_t now = gettime_ms();
+	int i, n = 0;
+
+	// expired items first
+	for (i = 0; cache.age && i < cache.count;) {
+		if (now - cache.items[i].last > cache.age) {
+			evicted[n++] = cache.items[i].key;
+			_cache_drop(i);
+		} else i++;
+	}
+
+	// then least recently used until there is room
+	while (cache.count && cache.used + room > cache.size) {
+		int lru = 0;
+
+		for (i = 1; i < cache.count; i++) {
+			if ((s32_t) (cache.items[i].last - cache.items[lru].last) < 0) lru = i;
+		}
+
+		LOG_INFO("evicting %016" PRIx64 " (%zu bytes)", cache.items[lru].key, cache.items[lru].size);
+		evicted[n++] = cache.items[lru].key;
+		_cache_drop(lru);
+	}
+
+	// caller unlinks these once it has released the lock
+	return n;
+}
+
+/*---------------------------------------------------------------------------*/
+static int _cache_find(u64_t key) {
+	int i;
+
+	for (i = 0; i < cache.count; i++) if (cache.items[i].key == key) return i;
+
+	return -1;
+}
+
+/*---------------------------------------------------------------------------*/
+static void _cache_push(int type, struct cache_rec *rec, const void *data, size_t len) {
+	struct cache_job *job;
+	bool write = type == CACHE_WRITE;
+
+	mutex_lock(cache.mutex);
+
+	// disk can't keep up, that recording is lost but streaming is not slowed down
+	if (write && (rec->dropped || cache.backlog + len > CACHE_BACKLOG)) {
+		if (!rec->dropped) LOG_WARN("cache can't keep up, dropping %016" PRIx64, rec->key);
+		rec->dropped = true;
+		mutex_unlock(cache.mutex);
+		return;
+	}
+
+	if (type == CACHE_COMMIT || type == CACHE_ABORT) job = rec->end;
+	else job = malloc(sizeof(struct cache_job) + (write ? len : 0));
+
+	// same as a recording that can't keep up
+	if (!job) {
+		LOG_WARN("can't queue cache job, dropping %016" PRIx64, rec->key);
+		rec->dropped = true;
+		mutex_unlock(cache.mutex);
+		return;
+	}
+
+	job->next = NULL;
+	job->type = type;
+	job->rec = rec;
+	job->len = len;
+	if (write) {
+		memcpy(job->data, data, len);
+		cache.backlog += len;
+	}
+
+	if (cache.last) cache.last->next = job;
+	else cache.jobs = job;
+	cache.last = job;
+
+	pthread_cond_signal(&cache.cond);
+	mutex_unlock(cache.mutex);
+}
+
+/*---------------------------------------------------------------------------*/
+static void cache_store(struct cache_rec *rec, size_t size) {
+	char tmp[STR_LEN + 64], name[STR_LEN + 32];
+	struct cache_entry *item;
+	u64_t *evicted;
+	int i, n;
+
+	_cache_tmp(tmp, rec);
+	_cache_name(name, rec->key, ".cache");
+
+	mutex_lock(cache.mutex);
+
+	// same content is replaced by rename, others are unlinked below
+	if ((evicted = malloc((cache.count + 1) * sizeof(u64_t))) == NULL) {
+		mutex_unlock(cache.mutex);
+		LOG_WARN("can't store %s, out of memory", name);
+		unlink(tmp);
+		return;
+	}
+
+	if ((i = _cache_find(rec->key)) >= 0) _cache_drop(i);
+	n = _cache_evict(size, evicted);
+
+	mutex_unlock(cache.mutex);
+
+	for (i = 0; i < n; i++) {
+		char old[STR_LEN + 32];
+		_cache_name(old, evicted[i], ".cache");
+		unlink(old);
+	}
+	free(evicted);
+
+	if (rename(tmp, name) < 0) {
+		LOG_WARN("can't store %s (%s)", name, strerror(errno));
+		unlink(tmp);
+		unlink(name);
+		return;
+	}
+
+	mutex_lock(cache.mutex);
+
+	if (cache.count == cache.max) {
+		int max = cache.max ? cache.max * 2 : 16;
+		struct cache_entry *items = realloc(cache.items, max * sizeof(struct cache_entry));
+
+		// can't be indexed, so don't leave it on disk
+		if (!items) {
+			mutex_unlock(cache.mutex);
+			LOG_WARN("can't index %s, out of memory", name);
+			unlink(name);
+			return;
+		}
+
+		cache.items = items;
+		cache.max = max;
+	}
+
+	item = cache.items + cache.count++;
+	item->key = rec->key;
+	item->size = size;
+	item->last = gettime_ms();
+	item->header = rec->header;
+	item->header_len = rec->header_len;
+	rec->header = NULL;
+	cache.used += size;
+
+	LOG_INFO("stored %016" PRIx64 " (%zu bytes), cache %zu/%zu", rec->key, size, cache.used, cache.size);
+
+	mutex_unlock(cache.mutex);
+}
+
+/*---------------------------------------------------------------------------*/
+static void cache_run(struct cache_job *job) {
+	struct cache_rec *rec = job->rec;
+	char tmp[STR_LEN + 64];
+
+	switch (job->type) {
+	case CACHE_OPEN:
+		_cache_tmp(tmp, rec);
+		rec->fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+		if (rec->fd < 0) {
+			LOG_WARN("can't create %s (%s)", tmp, strerror(errno));
+			rec->failed = true;
+		}
+		break;
+	case CACHE_WRITE:
+		if (rec->failed) break;
+		if (write(rec->fd, job->data, job->len) != (ssize_t) job->len) {
+			LOG_WARN("can't write to cache (%s)", strerror(errno));
+			rec->failed = true;
+		}
+		break;
+	case CACHE_COMMIT:
+	case CACHE_ABORT:
+		if (rec->fd >= 0) close(rec->fd);
+		// incomplete recording is of no use
+		if (job->type == CACHE_COMMIT && !rec->failed && !rec->dropped) {
+			cache_store(rec, job->len);
+		} else if (rec->fd >= 0) {
+			_cache_tmp(tmp, rec);
+			unlink(tmp);
+		}
+		free(rec->header);
+		free(rec);
+		break;
+	}
+}
+
+/*---------------------------------------------------------------------------*/
+static void *cache_thread(void *arg) {
+	mutex_lock(cache.mutex);
+
+	// finish what has been queued before leaving
+	while (cache.running || cache.jobs) {
+		struct cache_job *job = cache.jobs;
+
+		if (!job) {
+			pthread_cond_wait(&cache.cond, &cache.mutex);
+			continue;
+		}
+
+		if ((cache.jobs = job->next) == NULL) cache.last = NULL;
+		if (job->type == CACHE_WRITE) cache.backlog -= job->len;
+
+		mutex_unlock(cache.mutex);
+		cache_run(job);
+		free(job);
+		mutex_lock(cache.mutex);
+	}
+
+	mutex_unlock(cache.mutex);
+	return NULL;
+}
+#endif
+
+/*---------------------------------------------------------------------------*/
+void cache_init(const char *dir, unsigned size, unsigned age) {
+#if !WIN
+	DIR *d;
+	struct dirent *entry;
+
+	if (!dir || !*dir || !size) return;
+
+	mutex_create(cache.mutex);
+	pthread_cond_init(&cache.cond, NULL);
+	strncpy(cache.dir, dir, STR_LEN - 1);
+	cache.size = (size_t) size * 1024 * 1024;
+	cache.age = age * 60 * 1000;
+	cache.used = cache.count = cache.max = 0;
+	cache.hits = cache.misses = 0;
+	cache.items = NULL;
+	cache.jobs = cache.last = NULL;
+	cache.backlog = 0;
+
+	mkdir(cache.dir, 0755);
+
+	// index is not persisted, so whatever a previous run left is stale
+	if ((d = opendir(cache.dir)) != NULL) {
+		while ((entry = readdir(d)) != NULL) {
+			char name[STR_LEN + 256];
+
+			if (!_cache_owned(entry->d_name)) continue;
+			snprintf(name, sizeof(name), "%s/%s", cache.dir, entry->d_name);
+			unlink(name);
+		}
+		closedir(d);
+	}
+
+	cache.running = true;
+	pthread_create(&cache.thread, NULL, cache_thread, NULL);
+
+	LOG_INFO("stream cache in %s, %u MB", cache.dir, size);
+#else
+	if (dir && *dir && size) LOG_WARN("stream cache not supported on this platform", NULL);
+#endif
+}
+
+/*---------------------------------------------------------------------------*/
+void cache_end(void) {
+#if !WIN
+	if (!cache.size) return;
+
+	mutex_lock(cache.mutex);
+	cache.running = false;
+	pthread_cond_signal(&cache.cond);
+	mutex_unlock(cache.mutex);
+	pthread_join(cache.thread, NULL);
+
+	mutex_lock(cache.mutex);
+	while (cache.count) _cache_remove(0);
+	free(cache.items);
+	cache.items = NULL;
+	cache.size = 0;
+	mutex_unlock(cache.mutex);
+
+	pthread_cond_destroy(&cache.cond);
+	mutex_destroy(cache.mutex);
+#endif
+}
+
+/*---------------------------------------------------------------------------*/
+u64_t cache_key(const char *header) {
+	u64_t key = 0xcbf29ce484222325ULL;
+	const char *p, *eol;
+
+	// LMS's own stream URL is the same for every track, and ranges are partial
+	if (!cache.size || strncmp(header, "GET ", 4) || strstr(header, "player=") || strcasestr(header, "Range:")) return 0;
+
+	// request line and host are enough to identify content (FNV-1a)
+	if ((eol = strstr(header, "\r\n")) == NULL) return 0;
+	for (p = header; p < eol; p++) key = (key ^ (u8_t) *p) * 0x100000001b3ULL;
+
+	if ((p = strcasestr(header, "Host:")) != NULL) {
+		for (; *p && *p != '\r'; p++) key = (key ^ (u8_t) *p) * 0x100000001b3ULL;
+	}
+
+	return key ? key : 1;
+}
+
+/*---------------------------------------------------------------------------*/
+int cache_open(u64_t key, char *header, size_t *header_len) {
+	int fd = -1;
+#if !WIN
+	int i;
+
+	if (!key || !cache.size) return -1;
+
+	mutex_lock(cache.mutex);
+
+	if ((i = _cache_find(key)) >= 0) {
+		char name[STR_LEN + 32];
+
+		_cache_name(name, key, ".cache");
+		if ((fd = open(name, O_RDONLY)) >= 0) {
+			memcpy(header, cache.items[i].header, cache.items[i].header_len + 1);
+			*header_len = cache.items[i].header_len;
+			cache.items[i].last = gettime_ms();
+		} else {
+			_cache_remove(i);
+		}
+	}
+
+	// caller turns a hit it can't use into a miss with cache_miss
+	if (fd >= 0) cache.hits++;
+	else cache.misses++;
+
+	LOG_INFO("%s %016" PRIx64 " (hits:%u misses:%u)", fd >= 0 ? "hit" : "miss", key, cache.hits, cache.misses);
+
+	mutex_unlock(cache.mutex);
+#endif
+	return fd;
+}
+
+/*---------------------------------------------------------------------------*/
+struct cache_rec *cache_create(u64_t key, size_t size, const char *header, size_t header_len) {
+#if !WIN
+	struct cache_rec *rec;
+
+	// a single track shall not flush the whole cache
+	if (!key || !cache.size || size > cache.size / 4) return NULL;
+
+	// nothing is recorded rather than failing later
+	if ((rec = calloc(1, sizeof(struct cache_rec))) == NULL) return NULL;
+	rec->header = malloc(header_len + 1);
+	rec->end = malloc(sizeof(struct cache_job));
+	if (!rec->header || !rec->end) {
+		free(rec->header);
+		free(rec->end);
+		free(rec);
+		return NULL;
+	}
+
+	rec->key = key;
+	rec->fd = -1;
+	rec->header_len = header_len;
+	memcpy(rec->header, header, header_len);
+	rec->header[header_len] = '\0';
+
+	_cache_push(CACHE_OPEN, rec, NULL, 0);
+
+	return rec;
+#else
+	return NULL;
+#endif
+}
+
+/*---------------------------------------------------------------------------*/
+void cache_write(struct cache_rec *rec, const void *data, size_t len) {
+#if !WIN
+	if (rec && len) _cache_push(CACHE_WRITE, rec, data, len);
+#endif
+}
+
+/*---------------------------------------------------------------------------*/
+void cache_abort(struct cache_rec *rec) {
+#if !WIN
+	if (rec) _cache_push(CACHE_ABORT, rec, NULL, 0);
+#endif
+}
+
+/*---------------------------------------------------------------------------*/
+void cache_commit(struct cache_rec *rec, size_t size) {
+#if !WIN
+	if (rec) _cache_push(CACHE_COMMIT, rec, NULL, size);
+#endif
+}
+
+/*---------------------------------------------------------------------------*/
+// what cache_open returned could not be used after all
+void cache_miss(void) {
+#if !WIN
+	mutex_lock(cache.mutex);
+	cache.hits--;
+	cache.misses++;
+	mutex_unlock(cache.mutex);
+#endif
+}
+
+/*---------------------------------------------------------------------------*/
+void cache_stats(unsigned *hits, unsigned *misses, size_t *used, int *count) {
+	*hits = cache.hits;
+	*misses = cache.misses;
+	*used = cache.used;
+	*count = cache.count;
+}
@@ -0,0 +1,809 @@
+/*
+ *  Squeezelite - lightweight headless squeezebox emulator
+ *
+ *  (c) Philippe, philippe_44@outlook.com
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+// asynchronous LMS CLI client, requests are pipelined and replies come in order
+
+#include "squeezelite.h"
+
+#include <ctype.h>
+
+#define CLI_SEND_TO			500				// ms, for a reply once request is first in line
+#define CLI_CONNECT_TO		250
+#define CLI_KEEP_DURATION	(15*60*1000)
+#define CLI_PACKET			4096
+#define CLI_MAX_PACKET		(64*1024)		// longest reply line
+#define CLI_MAX_PENDING		32
+#define CLI_RETRY			5000			// ms, before re-opening a subscribed connection
+
+extern log_level	slimmain_loglevel;
+static log_level	*loglevel = &slimmain_loglevel;
+
+struct cli_req {
+	struct cli_req *next;
+	struct thread_ctx_s *ctx;	// NULL for the connection's own requests
+	char *cmd;					// encoded, replies echo it
+	bool query, decode, sent;
+	bool subscribe;
+	u32_t deadline;
+	cli_cb_t callback;
+	void *arg;
+	char *rsp;
+};
+
+// one connection per server, shared by all its players (commands carry player id)
+struct cli_conn {
+	struct cli_conn *next;
+	in_addr_t ip;
+	u16_t port;
+	int refs, subscribers;		// players using it, players wanting notifications
+	sockfd sock, polled;
+	short revents;
+	bool connected, live;		// live once notifications are flowing
+	u32_t deadline, last, retry;
+	struct cli_req *head, *tail;
+	int count;
+	char *wbuf, *rbuf;
+	size_t wlen, wsize, rlen, rsize;
+};
+
+// one thread serves all servers' CLI connections
+static struct {
+	thread_type thread;
+	mutex_type mutex;
+	bool running;
+	struct cli_conn *conns;
+#if !WINEVENT
+	event_event wake;
+#endif
+} cli;
+
+/*---------------------------------------------------------------------------*/
+static char from_hex(char ch) {
+
+  return isdigit(ch) ? ch - '0' : tolower(ch) - 'a' + 10;
+}
+
+/*---------------------------------------------------------------------------*/
+static char to_hex(char code) {
+  static char hex[] = "0123456789abcdef";
+  return hex[code & 15];
+}
+
+/*---------------------------------------------------------------------------*/
+/* IMPORTANT: be sure to free() the returned string after use */
+static char *cli_encode(char *str) {
+  char *pstr = str, *buf = malloc(strlen(str) * 3 + 1), *pbuf = buf;
+  while (*pstr) {
+	if ( isalnum(*pstr) || *pstr == '-' || *pstr == '_' || *pstr == '.' ||
+						  *pstr == '~' || *pstr == ' ' || *pstr == ')' ||
+						  *pstr == '(' )
+	  *pbuf++ = *pstr;
+	else if (*pstr == '%') {
+	  *pbuf++ = '%',*pbuf++ = '2', *pbuf++ = '5';
+	}
+	else {
+	  *pbuf++ = '%', *pbuf++ = to_hex(*pstr >> 4), *pbuf++ = to_hex(*pstr & 15);
+   }
+	pstr++;
+  }
+  *pbuf = '\0';
+  return buf;
+}
+
+/*---------------------------------------------------------------------------*/
+/* IMPORTANT: be sure to free() the returned string after use */
+static char *cli_decode(char *str) {
+  char *pstr = str, *buf = malloc(strlen(str) + 1), *pbuf = buf;
+  while (*pstr) {
+	if (*pstr == '%') {
+	  if (pstr[1] && pstr[2]) {
+		*pbuf++ = (from_hex(pstr[1]) << 4) | from_hex(pstr[2]);
+		pstr += 2;
+	  }
+	} else {
+	  *pbuf++ = *pstr;
+	}
+	pstr++;
+  }
+  *pbuf = '\0';
+  return buf;
+}
+
+
+/*---------------------------------------------------------------------------*/
+// index "tag%3avalue" items of a response in one pass, items without value are skipped
+int cli_parse(char *rsp, cli_tag_t *tags, int max) {
+	char *p = rsp;
+	int n = 0;
+
+	while (*p && n < max) {
+		char *end = p + strcspn(p, " \n"), *sep;
+
+		for (sep = p; sep + 3 <= end && strncasecmp(sep, "%3a", 3); sep++);
+
+		if (sep + 3 <= end) {
+			tags[n].tag = p;
+			tags[n].tag_len = sep - p;
+			tags[n].value = sep + 3;
+			tags[n++].len = end - sep - 3;
+		}
+
+		p = *end ? end + 1 : end;
+	}
+
+	return n;
+}
+
+/*---------------------------------------------------------------------------*/
+// name is given encoded (e.g. "playlist%20index")
+bool cli_tag_is(cli_tag_t *tag, char *name) {
+	return strlen(name) == tag->tag_len && !strncasecmp(tag->tag, name, tag->tag_len);
+}
+
+/*---------------------------------------------------------------------------*/
+/* decoded value is appended to arena, which must be as large as the response */
+char *cli_tag_value(cli_tag_t *tag, char **arena) {
+	char *p = tag->value, *end = p + tag->len, *value = *arena, *q = value;
+
+	while (p < end) {
+		if (*p == '%' && end - p > 2) {
+			*q++ = (from_hex(p[1]) << 4) | from_hex(p[2]);
+			p += 3;
+		} else *q++ = *p++;
+	}
+
+	*q++ = '\0';
+	*arena = q;
+
+	return value;
+}
+
+/*---------------------------------------------------------------------------*/
+static void cli_wake(void) {
+#if !WINEVENT
+	wake_signal(cli.wake);
+#endif
+}
+
+/*---------------------------------------------------------------------------*/
+static void _cli_done(struct cli_req *req, char *rsp, struct cli_req ***done) {
+	req->rsp = rsp;
+	req->next = NULL;
+	**done = req;
+	*done = &req->next;
+}
+
+/*---------------------------------------------------------------------------*/
+// completed requests are handed back through done list, callbacks run unlocked
+static void _cli_pop(struct cli_conn *conn, char *rsp, struct cli_req ***done) {
+	struct cli_req *req = conn->head;
+
+	if ((conn->head = req->next) == NULL) conn->tail = NULL;
+	conn->count--;
+
+	// next reply only starts being awaited now, a slow one must not time out the others
+	if (conn->head && conn->head->sent) conn->head->deadline = gettime_ms() + CLI_SEND_TO;
+
+	_cli_done(req, rsp, done);
+}
+
+/*---------------------------------------------------------------------------*/
+static void cli_newsong_callback(struct thread_ctx_s *ctx, char *rsp, void *arg) {
+	NFREE(rsp);
+	if (!ctx->in_use) return;
+	// new track starts from zero, don't let the previous position carry over
+	ctx->cli_status.time = 0;
+	ctx->cli_status.stamp = gettime_ms();
+	ctx->callback(ctx->MR, SQ_NEWMETADATA);
+}
+
+/*---------------------------------------------------------------------------*/
+// player leaves its connection, requests already sent are replaced by stubs that
+// keep replies in order, so a late reply never reaches whoever reuses that ctx
+static void _cli_release(struct thread_ctx_s *ctx, struct cli_req ***done) {
+	struct cli_conn *conn = ctx->cli;
+	struct cli_req **p, *prev = NULL;
+
+	ctx->cli = NULL;
+
+	if (ctx->cli_subscriber) {
+		ctx->cli_subscriber = false;
+		conn->subscribers--;
+	}
+
+	for (p = &conn->head; *p;) {
+		struct cli_req *req = *p;
+
+		if (req->ctx == ctx && req->sent) {
+			struct cli_req *stub = calloc(1, sizeof(struct cli_req));
+
+			stub->cmd = strdup(req->cmd);
+			stub->query = req->query;
+			stub->sent = true;
+			stub->deadline = req->deadline;
+			stub->next = req->next;
+			if (conn->tail == req) conn->tail = stub;
+			*p = stub;
+			_cli_done(req, NULL, done);
+			prev = stub;
+			p = &stub->next;
+		} else if (req->ctx == ctx) {
+			*p = req->next;
+			if (conn->tail == req) conn->tail = prev;
+			conn->count--;
+			_cli_done(req, NULL, done);
+		} else {
+			prev = req;
+			p = &req->next;
+		}
+	}
+
+	// connection thread frees it once drained
+	conn->refs--;
+	LOG_DEBUG("[%p]: left CLI connection %p (%d)", ctx, conn, conn->refs);
+}
+
+/*---------------------------------------------------------------------------*/
+static struct cli_conn *_cli_conn(struct thread_ctx_s *ctx, struct cli_req ***done) {
+	struct cli_conn *conn = ctx->cli;
+
+	// player might have moved to another server
+	if (conn && (conn->ip != ctx->slimproto_ip || conn->port != ctx->cli_port)) _cli_release(ctx, done);
+	if (ctx->cli) return ctx->cli;
+
+	for (conn = cli.conns; conn; conn = conn->next) {
+		if (conn->ip == ctx->slimproto_ip && conn->port == ctx->cli_port) break;
+	}
+
+	if (!conn) {
+		conn = calloc(1, sizeof(struct cli_conn));
+		conn->ip = ctx->slimproto_ip;
+		conn->port = ctx->cli_port;
+		conn->sock = conn->polled = -1;
+		conn->next = cli.conns;
+		cli.conns = conn;
+	}
+
+	conn->refs++;
+	ctx->cli = conn;
+	LOG_DEBUG("[%p]: joined CLI connection %p (%d)", ctx, conn, conn->refs);
+
+	return conn;
+}
+
+/*---------------------------------------------------------------------------*/
+static void _cli_free(struct cli_conn *conn) {
+	if (conn->sock >= 0) closesocket(conn->sock);
+	free(conn->wbuf);
+	free(conn->rbuf);
+	free(conn);
+}
+
+/*---------------------------------------------------------------------------*/
+// goes first on a new connection, whatever happened before it is reported as a change
+static void _cli_subscribe(struct cli_conn *conn, bool first) {
+	struct cli_req *req = calloc(1, sizeof(struct cli_req));
+
+	req->cmd = strdup("subscribe playlist");
+	req->subscribe = true;
+
+	if (first) {
+		if ((req->next = conn->head) == NULL) conn->tail = req;
+		conn->head = req;
+	} else {
+		if (conn->tail) conn->tail->next = req;
+		else conn->head = req;
+		conn->tail = req;
+	}
+
+	conn->count++;
+}
+
+/*---------------------------------------------------------------------------*/
+// notifications are for all players of the server, line is NULL to notify them all
+static void _cli_notify(struct cli_conn *conn, char *line, struct cli_req ***done) {
+	struct thread_ctx_s *ctx;
+	int i;
+
+	if (line && !strcasestr(line, " playlist ")) return;
+
+	for (i = 0; i < MAX_PLAYER; i++) {
+		struct cli_req *notify;
+
+		if ((ctx = thread_ctx[i]) == NULL || ctx->cli != conn || !ctx->cli_subscriber) continue;
+
+		if (line) {
+			char *id = cli_encode(ctx->cli_id), *p = line + strlen(id);
+			bool match = !strncasecmp(line, id, strlen(id)) && !strncasecmp(p, " playlist ", 10);
+
+			free(id);
+			if (!match) continue;
+
+			// LMS' own view of the mode, kept for sq_get_mode
+			p += 10;
+			if (!strncasecmp(p, "pause 1", 7)) ctx->cli_status.mode = SQ_PAUSE;
+			else if (!strncasecmp(p, "pause 0", 7)) ctx->cli_status.mode = SQ_PLAY;
+			else if (!strncasecmp(p, "stop", 4)) ctx->cli_status.mode = SQ_STOP;
+			else if (!strncasecmp(p, "newsong", 7)) ctx->cli_status.mode = SQ_PLAY;
+
+			if (strncasecmp(p, "newsong", 7)) return;
+			LOG_INFO("[%p]: new song notified", ctx);
+		}
+
+		notify = calloc(1, sizeof(struct cli_req));
+		notify->ctx = ctx;
+		notify->callback = cli_newsong_callback;
+		_cli_done(notify, NULL, done);
+	}
+}
+
+/*---------------------------------------------------------------------------*/
+static void _cli_disconnect(struct cli_conn *conn, struct cli_req ***done) {
+	if (conn->sock >= 0) closesocket(conn->sock);
+	conn->sock = -1;
+	conn->connected = conn->live = false;
+	conn->retry = gettime_ms() + CLI_RETRY;
+	conn->wlen = conn->rlen = 0;
+
+	while (conn->head) _cli_pop(conn, NULL, done);
+}
+
+/*---------------------------------------------------------------------------*/
+static void _cli_connect(struct cli_conn *conn, u32_t now) {
+	struct sockaddr_in addr;
+
+	conn->sock = socket(AF_INET, SOCK_STREAM, 0);
+	set_nonblock(conn->sock);
+	set_nosigpipe(conn->sock);
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = conn->ip;
+	addr.sin_port = htons(conn->port);
+
+	// completion (or failure) is reported as writable
+	connect(conn->sock, (struct sockaddr *) &addr, sizeof(addr));
+
+	conn->connected = false;
+	conn->deadline = now + CLI_CONNECT_TO;
+}
+
+/*---------------------------------------------------------------------------*/
+static bool _cli_write(struct cli_conn *conn, u32_t now) {
+	struct cli_req *req;
+	size_t sent = 0;
+
+	// requests not sent yet are all after the ones already sent
+	for (req = conn->head; req; req = req->next) {
+		size_t len;
+
+		if (req->sent) continue;
+
+		len = strlen(req->cmd) + 3;
+		if (conn->wlen + len > conn->wsize) {
+			conn->wsize = max(conn->wsize * 2, conn->wlen + len + CLI_PACKET);
+			conn->wbuf = realloc(conn->wbuf, conn->wsize);
+		}
+
+		conn->wlen += sprintf(conn->wbuf + conn->wlen, req->query ? "%s ?\n" : "%s\n", req->cmd);
+		req->sent = true;
+		req->deadline = now + CLI_SEND_TO;
+		LOG_SDEBUG("[%p]: cmd %s", req->ctx, req->cmd);
+	}
+
+	while (sent < conn->wlen) {
+		ssize_t n = send(conn->sock, conn->wbuf + sent, conn->wlen - sent, MSG_NOSIGNAL);
+
+		if (n <= 0) {
+			if (n < 0 && last_error() == ERROR_WOULDBLOCK) break;
+			LOG_WARN("[%p]: failed writing to CLI socket: %s", conn, strerror(last_error()));
+			return false;
+		}
+
+		sent += n;
+	}
+
+	conn->wlen -= sent;
+	memmove(conn->wbuf, conn->wbuf + sent, conn->wlen);
+
+	return true;
+}
+
+/*---------------------------------------------------------------------------*/
+static void _cli_line(struct cli_conn *conn, char *line, struct cli_req ***done) {
+	struct cli_req *req = conn->head;
+	size_t len = req ? strlen(req->cmd) : 0;
+
+	LOG_SDEBUG("[%p]: rsp %s", conn, line);
+
+	// replies come in order and start with the request, anything else is unsolicited
+	if (req && req->sent && !strncasecmp(line, req->cmd, len) && (line[len] == ' ' || !line[len])) {
+		char *p = line + len;
+		while (*p == ' ') p++;
+		_cli_pop(conn, req->decode ? cli_decode(p) : strdup(p), done);
+		if (req->subscribe) {
+			conn->live = true;
+			_cli_notify(conn, NULL, done);
+		}
+	} else if (conn->live && conn->subscribers) {
+		_cli_notify(conn, line, done);
+	} else {
+		LOG_DEBUG("[%p]: unexpected CLI line %.64s", conn, line);
+	}
+}
+
+/*---------------------------------------------------------------------------*/
+static bool _cli_read(struct cli_conn *conn, struct cli_req ***done) {
+	char *eol;
+	int n;
+
+	if (conn->rsize - conn->rlen < CLI_PACKET / 2) {
+		if (conn->rsize >= CLI_MAX_PACKET) {
+			LOG_ERROR("[%p]: CLI reply too long", conn);
+			return false;
+		}
+		conn->rsize = conn->rsize ? conn->rsize * 2 : CLI_PACKET;
+		conn->rbuf = realloc(conn->rbuf, conn->rsize + 1);
+	}
+
+	n = recv(conn->sock, conn->rbuf + conn->rlen, conn->rsize - conn->rlen, 0);
+
+	if (n <= 0) {
+		if (n < 0 && last_error() == ERROR_WOULDBLOCK) return true;
+		LOG_INFO("[%p]: CLI socket %d %s", conn, conn->sock, n ? strerror(last_error()) : "closed");
+		return false;
+	}
+
+	conn->rlen += n;
+	conn->rbuf[conn->rlen] = '\0';
+
+	while ((eol = strchr(conn->rbuf, '\n')) != NULL) {
+		*eol++ = '\0';
+		_cli_line(conn, conn->rbuf, done);
+		conn->rlen -= eol - conn->rbuf;
+		memmove(conn->rbuf, eol, conn->rlen + 1);
+	}
+
+	return true;
+}
+
+/*---------------------------------------------------------------------------*/
+// one step of a connection, returns what to poll for
+static short _cli_process(struct cli_conn *conn, short revents, int *timeout, u32_t now, struct cli_req ***done) {
+	s32_t wait;
+
+	if (conn->sock < 0 && (conn->head || (conn->subscribers && (s32_t) (now - conn->retry) >= 0))) {
+		_cli_connect(conn, now);
+	}
+
+	if (conn->sock < 0) {
+		if (conn->subscribers) *timeout = max(min((s32_t) (conn->retry - now), *timeout), 0);
+		return 0;
+	}
+
+	if (!conn->connected) {
+		int error = 0;
+		socklen_t len = sizeof(error);
+
+		if (revents) getsockopt(conn->sock, SOL_SOCKET, SO_ERROR, (void*) &error, &len);
+
+		if (revents && !error) {
+			LOG_INFO("[%p]: opened CLI socket %d (%d players)", conn, conn->sock, conn->refs);
+			conn->connected = true;
+			conn->last = now;
+			if (conn->subscribers) _cli_subscribe(conn, true);
+		} else if (revents || (s32_t) (now - conn->deadline) >= 0) {
+			LOG_ERROR("[%p] unable to connect to server with cli", conn);
+			_cli_disconnect(conn, done);
+			return 0;
+		} else {
+			wait = conn->deadline - now;
+			if (wait < *timeout) *timeout = max(wait, 0);
+			return POLLOUT;
+		}
+	}
+
+	if ((revents & (POLLIN | POLLHUP)) && !_cli_read(conn, done)) {
+		_cli_disconnect(conn, done);
+		return 0;
+	}
+
+	if ((conn->wlen || (conn->tail && !conn->tail->sent)) && !_cli_write(conn, now)) {
+		_cli_disconnect(conn, done);
+		return 0;
+	}
+
+	// a late reply will not match the next request and is just ignored
+	while (conn->head && conn->head->sent && (s32_t) (now - conn->head->deadline) >= 0) {
+		LOG_WARN("[%p]: Timeout waiting for CLI reponse (%s)", conn->head->ctx, conn->head->cmd);
+		_cli_pop(conn, NULL, done);
+	}
+
+	if (conn->head || conn->wlen) conn->last = now;
+
+	// notifications need the connection to stay
+	if (!conn->subscribers && now - conn->last > CLI_KEEP_DURATION) {
+		LOG_INFO("[%p] Closing CLI socket %d", conn, conn->sock);
+		_cli_disconnect(conn, done);
+		return 0;
+	}
+
+	if (conn->head) wait = conn->head->deadline - now;
+	else if (!conn->subscribers) wait = conn->last + CLI_KEEP_DURATION - now;
+	else wait = *timeout;
+	if (wait < *timeout) *timeout = max(wait, 0);
+
+	return conn->wlen ? POLLIN | POLLOUT : POLLIN;
+}
+
+/*---------------------------------------------------------------------------*/
+static void cli_callbacks(struct cli_req *done) {
+	while (done) {
+		struct cli_req *req = done;
+
+		done = req->next;
+		if (req->callback) req->callback(req->ctx, req->rsp, req->arg);
+		else free(req->rsp);
+		free(req->cmd);
+		free(req);
+	}
+}
+
+/*---------------------------------------------------------------------------*/
+static void *cli_thread(void *arg) {
+	while (cli.running) {
+		struct pollfd pollinfo[MAX_PLAYER + 1];
+		struct cli_conn *polled[MAX_PLAYER + 1], *conn, **p;
+		struct cli_req *done = NULL, **tail = &done;
+		int i, n, count = 0, timeout = 1000;
+		u32_t now = gettime_ms();
+
+#if WINEVENT
+		// can't be woken up, so new requests are detected by timeout
+		timeout = 10;
+#else
+		pollinfo[count].fd = wake_fd(cli.wake);
+		pollinfo[count].events = POLLIN;
+		polled[count++] = NULL;
+#endif
+
+		mutex_lock(cli.mutex);
+
+		for (p = &cli.conns; (conn = *p) != NULL;) {
+			short wanted;
+
+			// only this thread frees connections, so polled ones are still valid below
+			if (!conn->refs && !conn->head) {
+				LOG_INFO("[%p]: CLI connection unused", conn);
+				*p = conn->next;
+				_cli_free(conn);
+				continue;
+			}
+
+			// events only belong to the socket that was polled
+			wanted = _cli_process(conn, conn->sock == conn->polled ? conn->revents : 0, &timeout, now, &tail);
+			conn->revents = 0;
+			conn->polled = -1;
+
+			// can't be more servers than players, but draining ones come on top
+			if (wanted && count < MAX_PLAYER + 1) {
+				pollinfo[count].fd = conn->polled = conn->sock;
+				pollinfo[count].events = wanted;
+				polled[count++] = conn;
+			}
+
+			p = &conn->next;
+		}
+
+		mutex_unlock(cli.mutex);
+
+		cli_callbacks(done);
+
+		for (i = 0; i < count; i++) pollinfo[i].revents = 0;
+
+		if (count) n = poll(pollinfo, count, timeout);
+		else n = usleep(timeout * 1000);
+
+		mutex_lock(cli.mutex);
+
+		for (i = 0; n > 0 && i < count; i++) {
+			if (!pollinfo[i].revents) continue;
+#if !WINEVENT
+			if (!polled[i]) {
+				wake_clear(wake_fd(cli.wake));
+				continue;
+			}
+#endif
+			polled[i]->revents = pollinfo[i].revents;
+		}
+
+		mutex_unlock(cli.mutex);
+	}
+
+	return NULL;
+}
+
+/*---------------------------------------------------------------------------*/
+void cli_init(void) {
+	pthread_attr_t attr;
+
+	mutex_create(cli.mutex);
+#if !WINEVENT
+	wake_create(cli.wake);
+#endif
+
+	cli.conns = NULL;
+	cli.running = true;
+	pthread_attr_init(&attr);
+	pthread_attr_setstacksize(&attr, PTHREAD_STACK_MIN + SLIMPROTO_THREAD_STACK_SIZE);
+	pthread_create(&cli.thread, &attr, cli_thread, NULL);
+	pthread_attr_destroy(&attr);
+}
+
+/*---------------------------------------------------------------------------*/
+void cli_end(void) {
+	struct cli_req *done = NULL, **tail = &done;
+
+	cli.running = false;
+	cli_wake();
+	pthread_join(cli.thread, NULL);
+
+	while (cli.conns) {
+		struct cli_conn *conn = cli.conns;
+
+		cli.conns = conn->next;
+		_cli_disconnect(conn, &tail);
+		_cli_free(conn);
+	}
+
+	cli_callbacks(done);
+
+#if !WINEVENT
+	wake_close(cli.wake);
+#endif
+	mutex_destroy(cli.mutex);
+}
+
+/*---------------------------------------------------------------------------*/
+// player's pending requests are completed with a NULL response
+void cli_close(struct thread_ctx_s *ctx) {
+	struct cli_req *done = NULL, **tail = &done;
+
+	mutex_lock(cli.mutex);
+	if (ctx->cli) _cli_release(ctx, &tail);
+	mutex_unlock(cli.mutex);
+
+	cli_callbacks(done);
+	cli_wake();
+}
+
+/*---------------------------------------------------------------------------*/
+// keep server's connection open to be notified of playlist changes
+void cli_subscribe(struct thread_ctx_s *ctx) {
+	struct cli_req *done = NULL, **tail = &done;
+	struct cli_conn *conn;
+
+	mutex_lock(cli.mutex);
+
+	conn = _cli_conn(ctx, &tail);
+
+	if (!ctx->cli_subscriber) {
+		ctx->cli_subscriber = true;
+		if (!conn->subscribers++) {
+			conn->retry = gettime_ms();
+			// otherwise it will be the first thing sent once connected
+			if (conn->connected) _cli_subscribe(conn, false);
+		}
+	}
+
+	mutex_unlock(cli.mutex);
+
+	cli_callbacks(done);
+	cli_wake();
+}
+
+/*---------------------------------------------------------------------------*/
+bool cli_subscribed(struct thread_ctx_s *ctx) {
+	bool live;
+
+	mutex_lock(cli.mutex);
+	live = ctx->cli && ctx->cli_subscriber && ctx->cli->live;
+	mutex_unlock(cli.mutex);
+
+	return live;
+}
+
+/*---------------------------------------------------------------------------*/
+/* callback owns the response (NULL on failure) and is not called if this fails */
+bool cli_send_async(char *cmd, bool req, bool decode, cli_cb_t callback, void *arg, struct thread_ctx_s *ctx) {
+	struct cli_req *done = NULL, **tail = &done, *r;
+	struct cli_conn *conn;
+
+	mutex_lock(cli.mutex);
+
+	conn = _cli_conn(ctx, &tail);
+
+	if (conn->count >= CLI_MAX_PENDING * conn->refs) {
+		mutex_unlock(cli.mutex);
+		cli_callbacks(done);
+		LOG_WARN("[%p]: too many CLI requests pending (%s)", ctx, cmd);
+		return false;
+	}
+
+	r = calloc(1, sizeof(struct cli_req));
+	r->ctx = ctx;
+	r->cmd = cli_encode(cmd);
+	r->query = req;
+	r->decode = decode;
+	r->callback = callback;
+	r->arg = arg;
+
+	if (conn->tail) conn->tail->next = r;
+	else conn->head = r;
+	conn->tail = r;
+	conn->count++;
+
+	mutex_unlock(cli.mutex);
+
+	cli_callbacks(done);
+	cli_wake();
+
+	return true;
+}
+
+/*---------------------------------------------------------------------------*/
+struct cli_wait {
+	mutex_type mutex;
+	pthread_cond_t cond;
+	bool done;
+	char *rsp;
+};
+
+static void cli_wait_callback(struct thread_ctx_s *ctx, char *rsp, void *arg) {
+	struct cli_wait *wait = (struct cli_wait*) arg;
+
+	mutex_lock(wait->mutex);
+	wait->rsp = rsp;
+	wait->done = true;
+	pthread_cond_signal(&wait->cond);
+	mutex_unlock(wait->mutex);
+}
+
+/* IMPORTANT: be sure to free() the returned string after use, never call from a callback */
+char *cli_send_cmd(char *cmd, bool req, bool decode, struct thread_ctx_s *ctx) {
+	struct cli_wait wait;
+
+	mutex_create(wait.mutex);
+	pthread_cond_init(&wait.cond, NULL);
+	wait.done = false;
+	wait.rsp = NULL;
+
+	// every request is completed by the CLI thread, at least by timeout
+	if (cli_send_async(cmd, req, decode, cli_wait_callback, &wait, ctx)) {
+		mutex_lock(wait.mutex);
+		while (!wait.done) pthread_cond_wait(&wait.cond, &wait.mutex);
+		mutex_unlock(wait.mutex);
+	}
+
+	pthread_cond_destroy(&wait.cond);
+	mutex_destroy(wait.mutex);
+
+	return wait.rsp;
+}
@@ -30,6 +30,7 @@ extern log_level 	decode_loglevel;
 static log_level 	*loglevel = &decode_loglevel;
 
 struct codec	*codecs[MAX_CODECS];
+static mutex_type codecs_mutex;
 
 #define LOCK_S   mutex_lock(ctx->streambuf->mutex)
 #define UNLOCK_S mutex_unlock(ctx->streambuf->mutex)
@@ -99,7 +100,7 @@ static void *decode_thread(struct thread_ctx_s *ctx) {
 					if (ctx->output.fade_mode) _checkfade(false, ctx);
 					UNLOCK_O;
 
-					wake_controller(ctx);
+					post_status(ctx, STATUS_DECODE);
 				}
 
 				ran = true;
@@ -121,6 +122,9 @@ static void *decode_thread(struct thread_ctx_s *ctx) {
 void decode_init(void) {
 	int i = 0;
 
+	mutex_create(codecs_mutex);
+
+	// libraries are only loaded when a codec is first opened
 	codecs[i++] = register_pcm();
 	codecs[i++] = register_mad();
 	codecs[i++] = register_alac();
@@ -128,14 +132,20 @@ void decode_init(void) {
 	codecs[i++] = register_faad();
 	codecs[i++] = register_vorbis();
 	codecs[i++] = register_opus();
-#if RESAMPLE
-	register_soxr();
-#endif
 }
 
 
 /*---------------------------------------------------------------------------*/
 void decode_end(void) {
+	int i;
+
+	// release warm handles before their libraries are unloaded
+	for (i = 0; i < MAX_CODECS; i++) {
+		struct codec *codec = codecs[i];
+		if (!codec) continue;
+		while (codec->pool.count) codec->release(codec->pool.items[--codec->pool.count]);
+	}
+
 	deregister_pcm();
 	deregister_mad();
 	deregister_flac();
@@ -143,9 +153,8 @@ void decode_end(void) {
 	deregister_faad();
 	deregister_vorbis();
 	deregister_opus();
-#if RESAMPLE
-	deregister_soxr();
-#endif
+
+	mutex_destroy(codecs_mutex);
 }
 
 
@@ -218,6 +227,90 @@ unsigned decode_newstream(unsigned sample_rate, int supported_rates[], struct th
 	return sample_rate;
 }
 
+/*---------------------------------------------------------------------------*/
+static bool codec_load(struct codec *codec) {
+	bool loaded;
+
+	mutex_lock(codecs_mutex);
+
+	if (!codec->loaded) {
+		codec->loaded = (!codec->load || codec->load()) ? 1 : -1;
+		if (codec->loaded < 0) LOG_ERROR("cannot load library for codec '%c'", codec->id);
+	}
+	loaded = codec->loaded > 0;
+
+	mutex_unlock(codecs_mutex);
+
+	return loaded;
+}
+
+
+/*---------------------------------------------------------------------------*/
+// not loaded yet or loaded, only a library that failed makes it unavailable
+bool codec_available(struct codec *codec) {
+	bool available;
+
+	mutex_lock(codecs_mutex);
+	available = codec->loaded >= 0;
+	mutex_unlock(codecs_mutex);
+
+	return available;
+}
+
+
+/*---------------------------------------------------------------------------*/
+bool library_load(bool *loaded, bool (*load)(void)) {
+	bool done;
+
+	// players starting together shall not load the same library twice
+	mutex_lock(codecs_mutex);
+	if (!*loaded) *loaded = load();
+	done = *loaded;
+	mutex_unlock(codecs_mutex);
+
+	return done;
+}
+
+
+/*---------------------------------------------------------------------------*/
+void *codec_pool_get(struct codec *codec) {
+	void *handle = NULL;
+
+	mutex_lock(codecs_mutex);
+	if (codec->pool.count) handle = codec->pool.items[--codec->pool.count];
+	mutex_unlock(codecs_mutex);
+
+	return handle;
+}
+
+
+/*---------------------------------------------------------------------------*/
+bool codec_pool_put(struct codec *codec, void *handle) {
+	bool pooled = false;
+
+	mutex_lock(codecs_mutex);
+	if (codec->release && codec->pool.count < CODEC_POOL_SIZE) {
+		codec->pool.items[codec->pool.count++] = handle;
+		pooled = true;
+	}
+	mutex_unlock(codecs_mutex);
+
+	return pooled;
+}
+
+
+/*---------------------------------------------------------------------------*/
+bool codec_pool_full(struct codec *codec) {
+	bool full;
+
+	mutex_lock(codecs_mutex);
+	full = !codec->release || codec->pool.count >= CODEC_POOL_SIZE;
+	mutex_unlock(codecs_mutex);
+
+	return full;
+}
+
+
 /*---------------------------------------------------------------------------*/
 bool codec_open(u8_t codec, u8_t sample_size, u32_t sample_rate, u8_t channels, u8_t endianness, struct thread_ctx_s *ctx) {
 	int i;
@@ -238,6 +331,8 @@ bool codec_open(u8_t codec, u8_t sample_size, u32_t sample_rate, u8_t channels,
 
 		if (codecs[i] && codecs[i]->id == codec) {
 
+			if (!codec_load(codecs[i])) break;
+
 			if (ctx->codec && ctx->codec != codecs[i]) {
 				LOG_DEBUG("closing codec: '%c'", ctx->codec->id);
 				ctx->codec->close(ctx);
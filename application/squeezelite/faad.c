@@ -60,6 +60,7 @@ struct faad {
 	unsigned long samplerate;
 	unsigned char channels;
 	unsigned trak, play;
+	bool primed;
 };
 
 extern log_level decode_loglevel;
@@ -540,16 +541,42 @@ static decode_state faad_decode(struct thread_ctx_s *ctx) {
 	return DECODE_RUNNING;
 }
 
-static void faad_open(u8_t sample_size, u32_t sample_rate, u8_t channels, u8_t endianness, struct thread_ctx_s *ctx) {
+static void faad_prime(struct faad *a) {
 	NeAACDecConfigurationPtr conf;
+
+	// faad handle can only be initialized once, so we always need a new one
+	if (a->hAac) {
+		NEAAC(&ga, Close, a->hAac);
+	}
+	a->hAac = NEAAC(&ga, Open);
+
+	conf = NEAAC(&ga, GetCurrentConfiguration, a->hAac);
+
+	//FIXME: set 16 bits and maybe sample rate
+	conf->outputFormat = FAAD_FMT_16BIT;
+	conf->defSampleRate = 44100;
+	conf->downMatrix = 1;
+
+	if (!NEAAC(&ga, SetConfiguration, a->hAac, conf)) {
+		LOG_WARN("error setting config", NULL);
+	};
+
+	a->primed = true;
+}
+
+static void faad_open(u8_t sample_size, u32_t sample_rate, u8_t channels, u8_t endianness, struct thread_ctx_s *ctx) {
 	struct faad *a = ctx->decode.handle;
 
-	if (!a) {
-		a = ctx->decode.handle = malloc(sizeof(struct faad));
+	// take a warm (already primed) decoder from the pool if we don't have one
+	if (!a && (a = codec_pool_get(ctx->codec)) == NULL) {
+		a = malloc(sizeof(struct faad));
 		if (!a) return;
 		a->hAac = a->chunkinfo = a->stsc = NULL;
+		a->primed = false;
 	}
 
+	ctx->decode.handle = a;
+
 	// a bit of a hack here b/c sample size is not really a sample_size in that case
 	LOG_INFO("[%p]: opening %s stream", ctx, sample_size == '2' ? "adts" : "mp4");
 
@@ -565,28 +592,23 @@ static void faad_open(u8_t sample_size, u32_t sample_rate, u8_t channels, u8_t e
 	a->sttssamples = 0;
 	a->empty = false;
 
-	if (a->hAac) {
-		NEAAC(&ga, Close, a->hAac);
-	}
-	a->hAac = NEAAC(&ga, Open);
-
-	conf = NEAAC(&ga, GetCurrentConfiguration, a->hAac);
+	if (!a->primed) faad_prime(a);
+	a->primed = false;
+}
 
-	//FIXME: set 16 bits and maybe sample rate
-	conf->outputFormat = FAAD_FMT_16BIT;
-    conf->defSampleRate = 44100;
-	conf->downMatrix = 1;
+static void faad_release(void *handle) {
+	struct faad *a = handle;
 
-	if (!NEAAC(&ga, SetConfiguration, a->hAac, conf)) {
-		LOG_WARN("[%p]: error setting config", ctx);
-	};
+	if (a->hAac) NEAAC(&ga, Close, a->hAac);
+	free(a);
 }
 
 static void faad_close(struct thread_ctx_s *ctx) {
 	struct faad *a = ctx->decode.handle;
 
-	NEAAC(&ga, Close, a->hAac);
-	a->hAac = NULL;
+	ctx->decode.handle = NULL;
+	if (!a) return;
+
 	if (a->chunkinfo) {
 		free(a->chunkinfo);
 		a->chunkinfo = NULL;
@@ -595,8 +617,15 @@ static void faad_close(struct thread_ctx_s *ctx) {
 		free(a->stsc);
 		a->stsc = NULL;
 	}
-	free(a);
-	ctx->decode.handle = NULL;
+
+	// get the handle ready for next user before parking it, unless it can't be parked
+	if (codec_pool_full(ctx->codec)) {
+		faad_release(a);
+		return;
+	}
+
+	faad_prime(a);
+	if (!codec_pool_put(ctx->codec, a)) faad_release(a);
 }
 
 static bool load_faad(void) {
@@ -639,12 +668,10 @@ struct codec *register_faad(void) {
 		faad_open,    // open
 		faad_close,   // close
 		faad_decode,  // decode
+		load_faad,    // load
+		faad_release, // release
 	};
 
-	if (!load_faad()) {
-		return NULL;
-	}
-
 	LOG_INFO("using faad to decode aac", NULL);
 	return &ret;
 }
@@ -653,6 +680,7 @@ struct codec *register_faad(void) {
 void deregister_faad(void) {
 #if !LINKALL
 	if (ga.handle) dlclose(ga.handle);
+	ga.handle = NULL;
 #endif
 }
 
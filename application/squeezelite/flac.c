@@ -30,7 +30,7 @@ static struct {
 	const char **FLAC__StreamDecoderErrorStatusString;
 	const char **FLAC__StreamDecoderStateString;
 	FLAC__StreamDecoder * (* FLAC__stream_decoder_new)(void);
-	FLAC__bool (* FLAC__stream_decoder_reset)(FLAC__StreamDecoder *decoder);
+	FLAC__bool (* FLAC__stream_decoder_finish)(FLAC__StreamDecoder *decoder);
 	void (* FLAC__stream_decoder_delete)(FLAC__StreamDecoder *decoder);
 	FLAC__StreamDecoderInitStatus (* FLAC__stream_decoder_init_stream)(
 		FLAC__StreamDecoder *decoder,
@@ -225,25 +225,17 @@ static void error_cb(const FLAC__StreamDecoder *decoder, FLAC__StreamDecoderErro
 static void flac_open(u8_t sample_size, u32_t sample_rate, u8_t channels, u8_t endianness, struct thread_ctx_s *ctx) {
 	struct flac *f = ctx->decode.handle;
 
-	if (!f) {
-		f = ctx->decode.handle = malloc(sizeof(struct flac));
-		f->decoder = NULL;
-		f->container = '?';
-	}
-
-	if (!f) return;
-
-	if (f->decoder) {
-		if (f->container != sample_size ) {
-			FLAC(&gf, stream_decoder_delete, f->decoder);
-			f->decoder = FLAC(&gf, stream_decoder_new);
-		} else {
-			FLAC(&gf, stream_decoder_reset, f->decoder);
-		}
-	} else {
+	// take a warm decoder from the pool if we don't have one already
+	if (!f && (f = codec_pool_get(ctx->codec)) == NULL) {
+		f = malloc(sizeof(struct flac));
+		if (!f) return;
 		f->decoder = FLAC(&gf, stream_decoder_new);
 	}
 
+	ctx->decode.handle = f;
+
+	// back to uninitialized state (settings are reset), memory is kept
+	FLAC(&gf, stream_decoder_finish, f->decoder);
 	f->container = sample_size;
 
 	if ( f->container == 'o' ) {
@@ -265,12 +257,21 @@ static void flac_open(u8_t sample_size, u32_t sample_rate, u8_t channels, u8_t e
 	}
 }
 
+static void flac_release(void *handle) {
+	struct flac *f = handle;
+
+	FLAC(&gf, stream_decoder_delete, f->decoder);
+	free(f);
+}
+
 static void flac_close(struct thread_ctx_s *ctx) {
 	struct flac *f = ctx->decode.handle;
 
-	FLAC(&gf, stream_decoder_delete, f->decoder);
-	free(ctx->decode.handle);
 	ctx->decode.handle = NULL;
+	if (!f) return;
+
+	FLAC(&gf, stream_decoder_finish, f->decoder);
+	if (!codec_pool_put(ctx->codec, f)) flac_release(f);
 }
 
 static decode_state flac_decode(struct thread_ctx_s *ctx) {
@@ -305,7 +306,7 @@ static bool load_flac(void) {
 	gf.FLAC__StreamDecoderErrorStatusString = dlsym(gf.handle, "FLAC__StreamDecoderErrorStatusString");
 	gf.FLAC__StreamDecoderStateString = dlsym(gf.handle, "FLAC__StreamDecoderStateString");
 	gf.FLAC__stream_decoder_new = dlsym(gf.handle, "FLAC__stream_decoder_new");
-	gf.FLAC__stream_decoder_reset = dlsym(gf.handle, "FLAC__stream_decoder_reset");
+	gf.FLAC__stream_decoder_finish = dlsym(gf.handle, "FLAC__stream_decoder_finish");
 	gf.FLAC__stream_decoder_delete = dlsym(gf.handle, "FLAC__stream_decoder_delete");
 	gf.FLAC__stream_decoder_init_stream = dlsym(gf.handle, "FLAC__stream_decoder_init_stream");
 	gf.FLAC__stream_decoder_init_ogg_stream = dlsym(gf.handle, "FLAC__stream_decoder_init_ogg_stream");
@@ -324,7 +325,7 @@ static bool load_flac(void) {
 		LOG_INFO("OggFlac chaining disabled");
 	}
 	
-	LOG_INFO("loaded "libFLAC, NULL);
+	LOG_INFO("loaded "LIBFLAC, NULL);
 #elif !defined(FLAC__OGG_CHAINING)
 	LOG_INFO("OggFlac chaining disabled");
 #endif
@@ -341,12 +342,10 @@ struct codec *register_flac(void) {
 		flac_open,    // open
 		flac_close,   // close
 		flac_decode,  // decode
+		load_flac,    // load
+		flac_release, // release
 	};
 
-	if (!load_flac()) {
-		return NULL;
-	}
-
 	LOG_INFO("using flac to decode ogf,flc", NULL);
 	return &ret;
 }
@@ -355,6 +354,7 @@ struct codec *register_flac(void) {
 void deregister_flac(void) {
 #if !LINKALL
 	if (gf.handle) dlclose(gf.handle);
+	gf.handle = NULL;
 #endif
 }
 
@@ -420,12 +420,9 @@ struct codec *register_mad(void) {
 		mad_open,     // open
 		mad_close,    // close
 		mad_decode,   // decode
+		load_mad,     // load
 	};
 
-	if (!load_mad()) {
-		return NULL;
-	}
-
 	LOG_INFO("using mad to decode mp3", NULL);
 	return &ret;
 }
@@ -434,6 +431,7 @@ struct codec *register_mad(void) {
 void deregister_mad(void) {
 #if !LINKALL
 	if (gm.handle) dlclose(gm.handle);
+	gm.handle = NULL;
 #endif
 }
 
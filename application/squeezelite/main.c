@@ -27,12 +27,14 @@
 
 #define LOCK_S   mutex_lock(ctx->streambuf->mutex)
 #define UNLOCK_S mutex_unlock(ctx->streambuf->mutex)
+#define LOCK_O   mutex_lock(ctx->outputbuf->mutex)
+#define UNLOCK_O mutex_unlock(ctx->outputbuf->mutex)
 #define LOCK_D   mutex_lock(ctx->decode.mutex)
 #define UNLOCK_D mutex_unlock(ctx->decode.mutex)
 #define LOCK_P   mutex_lock(ctx->mutex)
 #define UNLOCK_P mutex_unlock(ctx->mutex)
 
-struct thread_ctx_s thread_ctx[MAX_PLAYER];
+struct thread_ctx_s *thread_ctx[MAX_PLAYER];
 char				sq_model_name[STR_LEN];
 struct in_addr		sq_local_host;
 bool				soxr_loaded = false;
@@ -41,6 +43,7 @@ bool				soxr_loaded = false;
 /* locals */
 /*----------------------------------------------------------------------------*/
 static void sq_wipe_device(struct thread_ctx_s *ctx);
+static struct thread_ctx_s *sq_ctx(sq_dev_handle_t handle);
 
 extern log_level	slimmain_loglevel;
 static log_level	*loglevel = &slimmain_loglevel;
@@ -50,8 +53,8 @@ void sq_end() {
 	int i;
 
 	for (i = 0; i < MAX_PLAYER; i++) {
-		if (thread_ctx[i].in_use) {
-			sq_wipe_device(&thread_ctx[i]);
+		if (thread_ctx[i] && thread_ctx[i]->in_use) {
+			sq_wipe_device(thread_ctx[i]);
 		}
 	}
 
@@ -59,7 +62,12 @@ void sq_end() {
 #if RESAMPLE
 	deregister_soxr();
 #endif
+	slimproto_end();
+	cli_end();
 	stream_end();
+	cache_end();
+
+	for (i = 0; i < MAX_PLAYER; i++) NFREE(thread_ctx[i]);
 }
 
 static bool lambda(void* caller, sq_action_t action, ...) {
@@ -72,6 +80,7 @@ void sq_wipe_device(struct thread_ctx_s *ctx) {
 	ctx->in_use = false;
 
 	slimproto_close(ctx);
+	cli_close(ctx);
 	output_close(ctx);
 #if RESAMPLE
 	process_end(ctx);
@@ -82,235 +91,68 @@ void sq_wipe_device(struct thread_ctx_s *ctx) {
 
 /*--------------------------------------------------------------------------*/
 void sq_delete_device(sq_dev_handle_t handle) {
-	struct thread_ctx_s *ctx = &thread_ctx[handle - 1];
-	sq_wipe_device(ctx);
-}
-
-/*---------------------------------------------------------------------------*/
-static char from_hex(char ch) {
-
-  return isdigit(ch) ? ch - '0' : tolower(ch) - 'a' + 10;
-}
-
-/*---------------------------------------------------------------------------*/
-static char to_hex(char code) {
-  static char hex[] = "0123456789abcdef";
-  return hex[code & 15];
-}
-
-/*---------------------------------------------------------------------------*/
-/* IMPORTANT: be sure to free() the returned string after use */
-static char *cli_encode(char *str) {
-  char *pstr = str, *buf = malloc(strlen(str) * 3 + 1), *pbuf = buf;
-  while (*pstr) {
-	if ( isalnum(*pstr) || *pstr == '-' || *pstr == '_' || *pstr == '.' ||
-						  *pstr == '~' || *pstr == ' ' || *pstr == ')' ||
-						  *pstr == '(' )
-	  *pbuf++ = *pstr;
-	else if (*pstr == '%') {
-	  *pbuf++ = '%',*pbuf++ = '2', *pbuf++ = '5';
-	}
-	else {
-	  *pbuf++ = '%', *pbuf++ = to_hex(*pstr >> 4), *pbuf++ = to_hex(*pstr & 15);
-   }
-	pstr++;
-  }
-  *pbuf = '\0';
-  return buf;
-}
-
-/*---------------------------------------------------------------------------*/
-/* IMPORTANT: be sure to free() the returned string after use */
-static char *cli_decode(char *str) {
-  char *pstr = str, *buf = malloc(strlen(str) + 1), *pbuf = buf;
-  while (*pstr) {
-	if (*pstr == '%') {
-	  if (pstr[1] && pstr[2]) {
-		*pbuf++ = (from_hex(pstr[1]) << 4) | from_hex(pstr[2]);
-		pstr += 2;
-	  }
-	} else {
-	  *pbuf++ = *pstr;
-	}
-	pstr++;
-  }
-  *pbuf = '\0';
-  return buf;
-}
-
-
-/*---------------------------------------------------------------------------*/
-
-/* IMPORTANT: be sure to free() the returned string after use */
-
-static char *cli_find_tag(char *str, char *tag)
-
-{
-	char *p, *res = NULL;
-	char *buf = malloc(max(strlen(str), strlen(tag)) + 4);
-
-	strcpy(buf, tag);
-	strcat(buf, "%3a");
-	if ((p = strcasestr(str, buf)) != NULL) {
-		int i = 0;
-		p += strlen(buf);
-		while (*(p+i) != ' ' && *(p+i) != '\n' && *(p+i)) i++;
-		if (i) {
-			strncpy(buf, p, i);
-			buf[i] = '\0';
-			res = url_decode(buf);
-		}
-	}
-	free(buf);
-	return res;
-}
-
-
-/*---------------------------------------------------------------------------*/
-bool cli_open_socket(struct thread_ctx_s *ctx) {
-	struct sockaddr_in addr;
-
-	if (ctx->cli_sock > 0) return true;
-
-	ctx->cli_sock = socket(AF_INET, SOCK_STREAM, 0);
-	set_nonblock(ctx->cli_sock);
-	set_nosigpipe(ctx->cli_sock);
-
-	addr.sin_family = AF_INET;
-	addr.sin_addr.s_addr = ctx->slimproto_ip;
-	addr.sin_port = htons(ctx->cli_port);
-
-	if (tcp_connect_timeout(ctx->cli_sock, addr, 250))  {
-		LOG_ERROR("[%p] unable to connect to server with cli", ctx);
-		closesocket(ctx->cli_sock);
-		ctx->cli_sock = -1;
-		return false;
-	}
-
-	LOG_INFO("[%p]: opened CLI socket %d", ctx, ctx->cli_sock);
-	return true;
+	struct thread_ctx_s *ctx = sq_ctx(handle);
+	if (ctx) sq_wipe_device(ctx);
 }
 
-
-
-/*---------------------------------------------------------------------------*/
-#define CLI_SEND_SLEEP (10000)
-#define CLI_SEND_TO (1*500000)
-#define CLI_KEEP_DURATION (15*60*1000)
-#define CLI_PACKET 4096
-char *cli_send_cmd(char *cmd, bool req, bool decode, struct thread_ctx_s *ctx) {
-	char *packet;
-	int wait;
-	size_t len;
-	char *rsp = NULL;
-
-	mutex_lock(ctx->cli_mutex);
-
-	if (!cli_open_socket(ctx)) {
-		mutex_unlock(ctx->cli_mutex);
-		return NULL;
-	}
-
-	packet = malloc(CLI_PACKET + 1);
-	ctx->cli_timeout = gettime_ms() + CLI_KEEP_DURATION;
-	wait = CLI_SEND_TO / CLI_SEND_SLEEP;
-
-	cmd = cli_encode(cmd);
-
-	if (req) len = sprintf(packet, "%s ?\n", cmd);
-	else len = sprintf(packet, "%s\n", cmd);
-
-	LOG_SDEBUG("[%p]: cmd %s", ctx, packet);
-
-	send_packet((u8_t*) packet, len, ctx->cli_sock);
-
-	// first receive the tag and then point to the last '\n'
-	len = 0;
-	while (wait)	{
-		int k;
-		fd_set rfds;
-		struct timeval timeout = {0, CLI_SEND_SLEEP};
-
-		FD_ZERO(&rfds);
-		FD_SET(ctx->cli_sock, &rfds);
-
-		k = select(ctx->cli_sock + 1, &rfds, NULL, NULL, &timeout);
-
-		if (!k) {
-			wait--;
-			continue;
-		}
-
-		if (k < 0) break;
-
-		k = recv(ctx->cli_sock, packet + len, CLI_PACKET - len, 0);
-		if (k <= 0) break;
-
-		len += k;
-		packet[len] = '\0';
-		if (strchr(packet, '\n') && strcasestr(packet, cmd)) {
-			rsp = packet;
-			break;
-		}
-	}
-
-	if (!wait) {
-		LOG_WARN("[%p]: Timeout waiting for CLI reponse (%s)", ctx, cmd);
-	}
-
-	LOG_SDEBUG("[%p]: rsp %s", ctx, rsp);
-
-	if (rsp && ((rsp = strcasestr(rsp, cmd)) != NULL)) {
-		rsp += strlen(cmd);
-		while (*rsp && *rsp == ' ') rsp++;
-
-		if (decode) rsp = cli_decode(rsp);
-		else rsp = strdup(rsp);
-		*(strrchr(rsp, '\n')) = '\0';
-	}
-
-	mutex_unlock(ctx->cli_mutex);
-
-	NFREE(cmd);
-	free(packet);
-
-	return rsp;
+/*--------------------------------------------------------------------------*/
+static sq_action_t cli_mode(char *rsp) {
+	if (!rsp) return SQ_NONE;
+	if (!strcasecmp(rsp, "play")) return SQ_PLAY;
+	if (!strcasecmp(rsp, "pause")) return SQ_PAUSE;
+	if (!strcasecmp(rsp, "stop")) return SQ_STOP;
+	return SQ_NONE;
 }
 
 /*--------------------------------------------------------------------------*/
 sq_action_t sq_get_mode(sq_dev_handle_t handle)
 {
-	struct thread_ctx_s *ctx = &thread_ctx[handle - 1];
+	struct thread_ctx_s *ctx = sq_ctx(handle);
 	char cmd[1024];
 	char *rsp;
 
-	if (!handle || !ctx->in_use) {
+	if (!ctx || !ctx->in_use) {
 		LOG_ERROR("[%p]: no handle %d", ctx, handle);
 		return true;
 	}
 
+	// notifications keep the mode up to date, otherwise LMS must be asked
+	if (cli_subscribed(ctx) && ctx->cli_status.mode != SQ_NONE) return ctx->cli_status.mode;
+
 	sprintf(cmd, "%s mode", ctx->cli_id);
-	rsp  = cli_send_cmd(cmd, true, false, ctx);
+	rsp = cli_send_cmd(cmd, true, false, ctx);
+	ctx->cli_status.mode = cli_mode(rsp);
+	NFREE(rsp);
 
-	if (!rsp) return SQ_NONE;
-	if (!strcasecmp(rsp, "play")) return SQ_PLAY;
-	if (!strcasecmp(rsp, "pause")) return SQ_PAUSE;
-	if (!strcasecmp(rsp, "stop")) return SQ_STOP;
+	return ctx->cli_status.mode;
+}
 
-	return SQ_NONE;
+
+/*--------------------------------------------------------------------------*/
+bool sq_subscribed(sq_dev_handle_t handle)
+{
+	struct thread_ctx_s *ctx = sq_ctx(handle);
+
+	if (!ctx || !ctx->in_use) return false;
+
+	// LMS tells about metadata changes, no need to poll
+	return cli_subscribed(ctx);
 }
 
 
 /*--------------------------------------------------------------------------*/
 bool sq_get_metadata(sq_dev_handle_t handle, metadata_t *metadata, bool next)
 {
-	struct thread_ctx_s *ctx = &thread_ctx[handle - 1];
-	char cmd[1024];
-	char *rsp, *p, *cur;
+	struct thread_ctx_s *ctx = sq_ctx(handle);
+	cli_tag_t tags[CLI_MAX_TAGS], *coverid = NULL;
+	metadata_t *cached = NULL;
+	char cmd[1024], key[128] = "";
+	char *rsp, *arena;
+	int i, j, n, tracks = 0;
 
 	metadata_init(metadata);
 
-	if (!handle || !ctx->in_use) {
+	if (!ctx || !ctx->in_use) {
 		LOG_ERROR("[%p]: no handle %d", ctx, handle);
 		metadata_defaults(metadata);
 		return false;
@@ -320,61 +162,77 @@ bool sq_get_metadata(sq_dev_handle_t handle, metadata_t *metadata, bool next)
 	rsp = cli_send_cmd(cmd, false, false, ctx);
 
 	if (!rsp || !*rsp) {
+		NFREE(rsp);
 		metadata_defaults(metadata);
 		LOG_WARN("[%p]: cannot get metadata", ctx);
 		return true;
 	}
 
-	// find the current index
-	if ((p = cli_find_tag(rsp, "playlist_cur_index")) != NULL) {
-		metadata->index = atoi(p);
-		if (next) metadata->index++;
-		free(p);
-	}
+	// index the response once, wanted values are decoded in metadata's arena
+	n = cli_parse(rsp, tags, CLI_MAX_TAGS);
 
-	// need to make sure we rollover if end of list
-	if ((p = cli_find_tag(rsp, "playlist_tracks")) != NULL) {
-		int len = atoi(p);
-		if (len) metadata->index %= len;
-		free(p);
+	// player's status comes before the first track
+	for (i = 0; i < n && !cli_tag_is(tags + i, "playlist%20index"); i++) {
+		if (cli_tag_is(tags + i, "playlist_cur_index")) metadata->index = atoi(tags[i].value);
+		else if (cli_tag_is(tags + i, "playlist_tracks")) tracks = atoi(tags[i].value);
 	}
 
-	sprintf(cmd, "playlist%%20index%%3a%d ", metadata->index);
+	// need to make sure we rollover if end of list
+	if (next) metadata->index++;
+	if (tracks) metadata->index %= tracks;
 
-	if ((cur = strcasestr(rsp, cmd)) != NULL) {
-		metadata->title = cli_find_tag(cur, "title");
-		metadata->artist = cli_find_tag(cur, "artist");
-		metadata->album = cli_find_tag(cur, "album");
-		metadata->genre = cli_find_tag(cur, "genre");
-		metadata->artwork = cli_find_tag(cur, "artwork_url");
+	// then each track starts with its index
+	for (; i < n; i++) {
+		if (cli_tag_is(tags + i, "playlist%20index") && (u32_t) atoi(tags[i].value) == metadata->index) break;
+	}
 
-		if ((p = cli_find_tag(cur, "duration")) != NULL) {
-			metadata->duration = 1000 * atof(p);
-			free(p);
+	// same track from same server and for same resolution (remote ones change title)
+	for (j = i + 1; j < n && !cli_tag_is(tags + j, "playlist%20index"); j++) {
+		if (cli_tag_is(tags + j, "remote") && atoi(tags[j].value) == 1) {
+			*key = '\0';
+			break;
 		}
-
-		if ((p = cli_find_tag(cur, "tracknum")) != NULL) {
-			metadata->track = atol(p);
-			free(p);
+		if (cli_tag_is(tags + j, "id") && tags[j].len) {
+			snprintf(key, sizeof(key), "%s:%s/%.*s/%s", ctx->server_ip, ctx->server_port, (int) tags[j].len,
+					 tags[j].value, ctx->config.resolution);
 		}
+	}
+
+	if (*key && (cached = metadata_cache_get(key)) != NULL) {
+		u32_t index = metadata->index;
 
-		if ((p = cli_find_tag(cur, "remote")) != NULL) {
-			metadata->remote = (atoi(p) == 1);
-			free(p);
+		*metadata = *cached;
+		metadata->index = index;
+		LOG_DEBUG("[%p]: cached metadata %s", ctx, key);
+	} else {
+		metadata->arena_size = strlen(rsp) + 1;
+		metadata->arena = arena = malloc(metadata->arena_size);
+
+		for (i++; i < n && !cli_tag_is(tags + i, "playlist%20index"); i++) {
+			cli_tag_t *tag = tags + i;
+
+			if (!tag->len) continue;
+
+			if (cli_tag_is(tag, "title")) metadata->title = cli_tag_value(tag, &arena);
+			else if (cli_tag_is(tag, "artist")) metadata->artist = cli_tag_value(tag, &arena);
+			else if (cli_tag_is(tag, "album")) metadata->album = cli_tag_value(tag, &arena);
+			else if (cli_tag_is(tag, "genre")) metadata->genre = cli_tag_value(tag, &arena);
+			else if (cli_tag_is(tag, "artwork_url")) metadata->artwork = cli_tag_value(tag, &arena);
+			else if (cli_tag_is(tag, "duration")) metadata->duration = 1000 * atof(tag->value);
+			else if (cli_tag_is(tag, "tracknum")) metadata->track = atol(tag->value);
+			else if (cli_tag_is(tag, "remote")) metadata->remote = (atoi(tag->value) == 1);
+			else if (cli_tag_is(tag, "coverid")) coverid = tag;
 		}
 
-		if (!metadata->artwork || !strlen(metadata->artwork)) {
-			NFREE(metadata->artwork);
-			if ((p = cli_find_tag(cur, "coverid")) != NULL) {
-				(void)!asprintf(&metadata->artwork, "http://%s:%s/music/%s/cover_%s.jpg", ctx->server_ip, ctx->server_port, p, ctx->config.resolution);
-				free(p);
-			}
+		if (!metadata->artwork && coverid) {
+			(void)!asprintf(&metadata->artwork, "http://%s:%s/music/%s/cover_%s.jpg", ctx->server_ip, ctx->server_port,
+							cli_tag_value(coverid, &arena), ctx->config.resolution);
 		}
 
+		// artwork still in arena, so it is not freed when replaced
 		if (metadata->artwork && strncmp(metadata->artwork, "http", 4)) {
-			char* artwork;
+			char *artwork, *p = strrchr(metadata->artwork, '.');
 
-			p = strrchr(metadata->artwork, '.');
 			if (*ctx->config.resolution && p && (strcasecmp(p, ".jpg") || strcasecmp(p, ".png"))) {
 				*p = '\0';
 				(void)!asprintf(&artwork, "http://%s:%s/%s_%s.%s", ctx->server_ip, ctx->server_port,
@@ -385,7 +243,6 @@ bool sq_get_metadata(sq_dev_handle_t handle, metadata_t *metadata, bool next)
 					*(metadata->artwork) == '/' ? metadata->artwork + 1 : metadata->artwork);
 			}
 
-			free(metadata->artwork);
 			metadata->artwork = artwork;
 		}
 	}
@@ -394,6 +251,9 @@ bool sq_get_metadata(sq_dev_handle_t handle, metadata_t *metadata, bool next)
 
 	metadata_defaults(metadata);
 
+	if (cached) free(cached);
+	else if (*key) metadata_cache_put(key, metadata);
+
 	LOG_DEBUG("[%p]: idx %d\n\tartist:%s\n\talbum:%s\n\ttitle:%s\n\tgenre:%s\n\tduration:%d.%03d\n\tsize:%d\n\tcover:%s", ctx, metadata->index,
 				metadata->artist, metadata->album, metadata->title,
 				metadata->genre, div(metadata->duration, 1000).quot,
@@ -403,29 +263,39 @@ bool sq_get_metadata(sq_dev_handle_t handle, metadata_t *metadata, bool next)
 	return true;
 }
 
+/*--------------------------------------------------------------------------*/
+static void cli_time_callback(struct thread_ctx_s *ctx, char *rsp, void *arg) {
+	if (rsp && *rsp) {
+		ctx->cli_status.time = (u32_t) (atof(rsp) * 1000);
+		ctx->cli_status.stamp = gettime_ms();
+	} else {
+		LOG_ERROR("[%p] cannot gettime", ctx);
+	}
+
+	NFREE(rsp);
+}
+
 /*--------------------------------------------------------------------------*/
 u32_t sq_get_time(sq_dev_handle_t handle)
 {
-	struct thread_ctx_s *ctx = &thread_ctx[handle - 1];
+	struct thread_ctx_s *ctx = sq_ctx(handle);
 	char cmd[128];
-	char *rsp;
-	u32_t time = 0;
+	u32_t time;
 
-	if (!handle || !ctx->in_use) {
+	if (!ctx || !ctx->in_use || !ctx->outputbuf) {
 		LOG_ERROR("[%p]: no handle or CLI socket %d", ctx, handle);
 		return 0;
 	}
 
+	// last known position, moved forward while the player plays
+	LOCK_O;
+	time = ctx->cli_status.time;
+	if (ctx->output.state == OUTPUT_RUNNING && ctx->cli_status.stamp) time += gettime_ms() - ctx->cli_status.stamp;
+	UNLOCK_O;
+
 	sprintf(cmd, "%s time", ctx->cli_id);
-	rsp = cli_send_cmd(cmd, true, true, ctx);
-	if (rsp && *rsp) {
-		time = (u32_t) (atof(rsp) * 1000);
-	}
-	else {
-		LOG_ERROR("[%p] cannot gettime", ctx);
-	}
+	cli_send_async(cmd, true, true, cli_time_callback, NULL, ctx);
 
-	NFREE(rsp);
 	return time;
 }
 
@@ -433,11 +303,11 @@ u32_t sq_get_time(sq_dev_handle_t handle)
 /*---------------------------------------------------------------------------*/
 bool sq_set_time(sq_dev_handle_t handle, char *pos)
 {
-	struct thread_ctx_s *ctx = &thread_ctx[handle - 1];
+	struct thread_ctx_s *ctx = sq_ctx(handle);
 	char cmd[128];
 	char *rsp;
 
-	if (!handle || !ctx->in_use) {
+	if (!ctx || !ctx->in_use) {
 		LOG_ERROR("[%p]: no handle or cli socket %d", ctx, handle);
 		return false;
 	}
@@ -456,16 +326,33 @@ bool sq_set_time(sq_dev_handle_t handle, char *pos)
 }
 
 
+/*--------------------------------------------------------------------------*/
+static void cli_pause_callback(struct thread_ctx_s *ctx, char *rsp, void *arg) {
+	char cmd[128];
+
+	if (!ctx->running) {
+		NFREE(rsp);
+		return;
+	}
+
+	// pause is a toggle unless we know what to set
+	if (rsp && *rsp) sprintf(cmd, "%s pause %d", ctx->cli_id, strstr(rsp, "pause") ? 0 : 1);
+	else sprintf(cmd, "%s pause", ctx->cli_id);
+
+	cli_send_async(cmd, false, true, NULL, NULL, ctx);
+	NFREE(rsp);
+}
+
 /*--------------------------------------------------------------------------*/
 void sq_notify(sq_dev_handle_t handle, sq_event_t event, ...)
 {
-	struct thread_ctx_s *ctx = &thread_ctx[handle - 1];
-	char cmd[128] = "", *rsp;
+	struct thread_ctx_s *ctx = sq_ctx(handle);
+	char cmd[128] = "";
 
 	LOG_SDEBUG("[%p] notif %d", ctx, event);
 
 	// squeezelite device has not started yet or is off ...
-	if (!ctx->running || !ctx->on || !handle || !ctx->in_use) return;
+	if (!ctx || !ctx->in_use || !ctx->running || !ctx->on) return;
 
 	va_list args;
 	va_start(args, event);
@@ -480,12 +367,10 @@ void sq_notify(sq_dev_handle_t handle, sq_event_t event, ...)
 			break;
 		}
 		case SQ_PAUSE: {
+			// actual pause command is sent once mode is known
 			sprintf(cmd, "%s mode", ctx->cli_id);
-			rsp = cli_send_cmd(cmd, true, true, ctx);
-			if (rsp && *rsp)
-				sprintf(cmd, "%s pause %d", ctx->cli_id, strstr(rsp, "pause") ? 0 : 1);
-			else
-				sprintf(cmd, "%s pause", ctx->cli_id);
+			cli_send_async(cmd, true, true, cli_pause_callback, NULL, ctx);
+			*cmd = '\0';
 			break;
 		}
 		case SQ_STOP: {
@@ -530,10 +415,8 @@ void sq_notify(sq_dev_handle_t handle, sq_event_t event, ...)
 
 	va_end(args);
 
-	if (*cmd) {
-		rsp = cli_send_cmd(cmd, false, true, ctx);
-		NFREE(rsp);
-   }
+	// nobody waits for the reply
+	if (*cmd) cli_send_async(cmd, false, true, NULL, NULL, ctx);
 }
 
 
@@ -544,16 +427,28 @@ void sq_init(struct in_addr host, char *model_name)
 	sq_local_host = host;
 	strcpy(sq_model_name, model_name);
 	decode_init();
-#if RESAMPLE
-	soxr_loaded = register_soxr();
-#endif
 	stream_init();
+	cli_init();
+	slimproto_init();
+}
+
+/*---------------------------------------------------------------------------*/
+void sq_cache_init(char *dir, unsigned size, unsigned age)
+{
+	cache_init(dir, size, age);
+}
+
+/*---------------------------------------------------------------------------*/
+void sq_cache_stats(unsigned *hits, unsigned *misses, size_t *used, int *count)
+{
+	cache_stats(hits, misses, used, count);
 }
 
 /*---------------------------------------------------------------------------*/
 void sq_release_device(sq_dev_handle_t handle)
 {
-	if (handle) thread_ctx[handle - 1].in_use = false;
+	struct thread_ctx_s *ctx = sq_ctx(handle);
+	if (ctx) ctx->in_use = false;
 }
 
 /*---------------------------------------------------------------------------*/
@@ -563,17 +458,20 @@ sq_dev_handle_t sq_reserve_device(void *MR, sq_callback_t callback)
 	struct thread_ctx_s *ctx;
 
 	/* find a free thread context - this must be called in a LOCKED context */
-	for  (ctx_i = 0; ctx_i < MAX_PLAYER; ctx_i++) if (!thread_ctx[ctx_i].in_use) break;
+	for  (ctx_i = 0; ctx_i < MAX_PLAYER; ctx_i++) if (!thread_ctx[ctx_i] || !thread_ctx[ctx_i]->in_use) break;
 
-	if (ctx_i < MAX_PLAYER)	{
-		// this sets a LOT of data to proper defaults (NULL, false ...)
-		memset(&thread_ctx[ctx_i], 0, sizeof(struct thread_ctx_s));
-		thread_ctx[ctx_i].in_use = true;
-	} else {
+	if (ctx_i == MAX_PLAYER) {
+		LOG_ERROR("too many players (max:%u)", MAX_PLAYER);
 		return false;
 	}
 
-	ctx = thread_ctx + ctx_i;
+	// contexts are only allocated when needed and then kept for reuse
+	if (!thread_ctx[ctx_i]) thread_ctx[ctx_i] = calloc(1, sizeof(struct thread_ctx_s));
+
+	// this sets a LOT of data to proper defaults (NULL, false ...)
+	ctx = thread_ctx[ctx_i];
+	memset(ctx, 0, sizeof(struct thread_ctx_s));
+	ctx->in_use = true;
 	ctx->self = ctx_i + 1;
 	ctx->on = false;
 	ctx->callback = callback;
@@ -586,7 +484,7 @@ sq_dev_handle_t sq_reserve_device(void *MR, sq_callback_t callback)
 /*---------------------------------------------------------------------------*/
 bool sq_run_device(sq_dev_handle_t handle, struct raopcl_s *raopcl, sq_dev_param_t *param)
 {
-	struct thread_ctx_s *ctx = &thread_ctx[handle - 1];
+	struct thread_ctx_s *ctx = sq_ctx(handle);
 
 	memcpy(&ctx->config, param, sizeof(sq_dev_param_t));
 
@@ -613,8 +511,14 @@ bool sq_run_device(sq_dev_handle_t handle, struct raopcl_s *raopcl, sq_dev_param
 /*--------------------------------------------------------------------------*/
 void *sq_get_ptr(sq_dev_handle_t handle)
 {
-	if (!handle) return NULL;
-	else return thread_ctx + handle - 1;
+	return sq_ctx(handle);
+}
+
+/*--------------------------------------------------------------------------*/
+static struct thread_ctx_s *sq_ctx(sq_dev_handle_t handle)
+{
+	// NULL for handles never reserved
+	return handle > 0 && handle <= MAX_PLAYER ? thread_ctx[handle - 1] : NULL;
 }
 
 
@@ -10,6 +10,7 @@
 
 #include <stdlib.h>
 #include <string.h>
+#include <pthread.h>
 
 #include "metadata.h"
 
@@ -18,15 +19,21 @@
 	if (s) free(s);      \
 	s = NULL;            \
 } while (0)	
+#define __OWNED__(self, s) ((s) < (self)->arena || (s) >= (self)->arena + (self)->arena_size)
+#define __RELEASE__(self, s) do {		\
+	if (__OWNED__(self, s)) __FREE__(s);	\
+	s = NULL;								\
+} while (0)
 
 void metadata_free(struct metadata_s* const self) {
 	if (!self) return;
-	__FREE__(self->artist);
-	__FREE__(self->album);
-	__FREE__(self->title);
-	__FREE__(self->remote_title);
-	__FREE__(self->artwork);
-	__FREE__(self->genre);
+	__RELEASE__(self, self->artist);
+	__RELEASE__(self, self->album);
+	__RELEASE__(self, self->title);
+	__RELEASE__(self, self->remote_title);
+	__RELEASE__(self, self->artwork);
+	__RELEASE__(self, self->genre);
+	__FREE__(self->arena);
 	metadata_init(self);
 }
 
@@ -41,6 +48,8 @@ struct metadata_s* metadata_clone(struct metadata_s* const self) {
 	clone->remote_title = __STRDUP__(self->remote_title);
 	clone->artwork = __STRDUP__(self->artwork);
 	clone->genre = __STRDUP__(self->genre);
+	clone->arena = NULL;
+	clone->arena_size = 0;
 	return clone;
 }
 
@@ -59,3 +68,182 @@ struct metadata_s* metadata_init(struct metadata_s* self) {
 	memset(self, 0, sizeof(*self));
 	return self;
 }
+
+/*----------------------------------------------------------------------------*/
+/* process-wide cache: metadata by track id, artwork by url, LRU bound by memory */
+/*----------------------------------------------------------------------------*/
+static struct {
+	pthread_mutex_t mutex;
+	size_t size, used;
+	uint32_t tick;
+	int count, max;
+	struct metadata_cache_s {
+		char *key;
+		uint32_t hash, last;
+		bool artwork;
+		size_t size;
+		struct metadata_s *metadata;
+		char *content_type, *image;
+		int image_size;
+	} *items;
+} cache = { PTHREAD_MUTEX_INITIALIZER };
+
+/*----------------------------------------------------------------------------*/
+static uint32_t _cache_hash(const char *key) {
+	uint32_t hash = 0x811c9dc5;
+	while (*key) hash = (hash ^ (uint8_t) *key++) * 0x01000193;
+	return hash;
+}
+
+/*----------------------------------------------------------------------------*/
+static size_t _cache_size(struct metadata_s *self) {
+	size_t size = sizeof(*self);
+
+	if (self->artist) size += strlen(self->artist) + 1;
+	if (self->album) size += strlen(self->album) + 1;
+	if (self->title) size += strlen(self->title) + 1;
+	if (self->remote_title) size += strlen(self->remote_title) + 1;
+	if (self->artwork) size += strlen(self->artwork) + 1;
+	if (self->genre) size += strlen(self->genre) + 1;
+
+	return size;
+}
+
+/*----------------------------------------------------------------------------*/
+static void _cache_remove(int i) {
+	struct metadata_cache_s *item = cache.items + i;
+
+	cache.used -= item->size;
+	free(item->key);
+	if (item->metadata) {
+		metadata_free(item->metadata);
+		free(item->metadata);
+	}
+	__FREE__(item->content_type);
+	__FREE__(item->image);
+	*item = cache.items[--cache.count];
+}
+
+/*----------------------------------------------------------------------------*/
+static int _cache_find(const char *key, uint32_t hash, bool artwork) {
+	for (int i = 0; i < cache.count; i++) {
+		struct metadata_cache_s *item = cache.items + i;
+		if (item->hash == hash && item->artwork == artwork && !strcmp(item->key, key)) return i;
+	}
+	return -1;
+}
+
+/*----------------------------------------------------------------------------*/
+static struct metadata_cache_s *_cache_add(const char *key, bool artwork, size_t size) {
+	uint32_t hash = _cache_hash(key);
+	struct metadata_cache_s *item;
+	int i;
+
+	if ((i = _cache_find(key, hash, artwork)) >= 0) _cache_remove(i);
+
+	// least recently used go first
+	while (cache.count && cache.used + size > cache.size) {
+		int lru = 0;
+		for (i = 1; i < cache.count; i++) {
+			if ((int32_t) (cache.items[i].last - cache.items[lru].last) < 0) lru = i;
+		}
+		_cache_remove(lru);
+	}
+
+	if (cache.count == cache.max) {
+		cache.max = cache.max ? cache.max * 2 : 32;
+		cache.items = realloc(cache.items, cache.max * sizeof(struct metadata_cache_s));
+	}
+
+	item = cache.items + cache.count++;
+	memset(item, 0, sizeof(*item));
+	item->key = strdup(key);
+	item->hash = hash;
+	item->artwork = artwork;
+	item->size = size + strlen(key) + 1;
+	item->last = ++cache.tick;
+	cache.used += item->size;
+
+	return item;
+}
+
+/*----------------------------------------------------------------------------*/
+void metadata_cache_init(size_t size) {
+	pthread_mutex_lock(&cache.mutex);
+	cache.size = size;
+	cache.used = cache.count = 0;
+	pthread_mutex_unlock(&cache.mutex);
+}
+
+/*----------------------------------------------------------------------------*/
+void metadata_cache_end(void) {
+	// mutex stays, a late artwork fetch might still try
+	pthread_mutex_lock(&cache.mutex);
+	while (cache.count) _cache_remove(0);
+	__FREE__(cache.items);
+	cache.size = cache.max = 0;
+	pthread_mutex_unlock(&cache.mutex);
+}
+
+/*----------------------------------------------------------------------------*/
+/* returns a clone to be freed by caller, NULL if unknown */
+struct metadata_s* metadata_cache_get(const char *id) {
+	struct metadata_s *clone = NULL;
+	int i;
+
+	pthread_mutex_lock(&cache.mutex);
+	if (cache.size && (i = _cache_find(id, _cache_hash(id), false)) >= 0) {
+		cache.items[i].last = ++cache.tick;
+		clone = metadata_clone(cache.items[i].metadata);
+	}
+	pthread_mutex_unlock(&cache.mutex);
+
+	return clone;
+}
+
+/*----------------------------------------------------------------------------*/
+void metadata_cache_put(const char *id, struct metadata_s* const self) {
+	size_t size = _cache_size(self);
+
+	pthread_mutex_lock(&cache.mutex);
+	if (size < cache.size / 4) _cache_add(id, false, size)->metadata = metadata_clone(self);
+	pthread_mutex_unlock(&cache.mutex);
+}
+
+/*----------------------------------------------------------------------------*/
+/* returns image size and copies to be freed by caller, 0 if unknown */
+int artwork_cache_get(const char *url, char **content_type, char **image) {
+	int i, size = 0;
+
+	pthread_mutex_lock(&cache.mutex);
+	if (cache.size && (i = _cache_find(url, _cache_hash(url), true)) >= 0) {
+		struct metadata_cache_s *item = cache.items + i;
+
+		item->last = ++cache.tick;
+		size = item->image_size;
+		*content_type = __STRDUP__(item->content_type);
+		*image = malloc(size);
+		memcpy(*image, item->image, size);
+	}
+	pthread_mutex_unlock(&cache.mutex);
+
+	return size;
+}
+
+/*----------------------------------------------------------------------------*/
+void artwork_cache_put(const char *url, const char *content_type, const char *image, int size) {
+	struct metadata_cache_s *item;
+
+	pthread_mutex_lock(&cache.mutex);
+
+	// a single cover shall not flush the whole cache
+	if (size > 0 && (size_t) size < cache.size / 4) {
+		item = _cache_add(url, true, size + (content_type ? strlen(content_type) + 1 : 0));
+		item->content_type = __STRDUP__(content_type);
+		item->image = malloc(size);
+		item->image_size = size;
+		memcpy(item->image, image, size);
+	}
+
+	pthread_mutex_unlock(&cache.mutex);
+}
@@ -12,6 +12,7 @@
 
 #include <stdint.h>
 #include <stdbool.h>
+#include <stddef.h>
 
 typedef struct metadata_s {
 	char* artist;
@@ -28,9 +29,18 @@ typedef struct metadata_s {
 	uint8_t  channels;
 	uint32_t bitrate;
 	bool remote;
+	char *arena;			// strings pointing there are not freed individually
+	size_t arena_size;
 } metadata_t;
 
 struct metadata_s* metadata_init(struct metadata_s* self);
 struct metadata_s* metadata_clone(struct metadata_s* const self);
 void   metadata_free(struct metadata_s* const self);
 void   metadata_defaults(struct metadata_s* const self);
+
+void   metadata_cache_init(size_t size);
+void   metadata_cache_end(void);
+struct metadata_s* metadata_cache_get(const char *id);
+void   metadata_cache_put(const char *id, struct metadata_s* const self);
+int    artwork_cache_get(const char *url, char **content_type, char **image);
+void   artwork_cache_put(const char *url, const char *content_type, const char *image, int size);
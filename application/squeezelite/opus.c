@@ -253,12 +253,9 @@ struct codec *register_opus(void) {
 		opus_open,    // open
 		opus_close,   // close
 		opus_decompress,  // decode
+		load_opus,    // load
 	};
 
-	if (!load_opus()) {
-		return NULL;
-	}
-
 	LOG_INFO("using opus to decode ops", NULL);
 	return &ret;
 }
@@ -266,5 +263,6 @@ struct codec *register_opus(void) {
 void deregister_opus(void) {
 #if !LINKALL
 	if (gu.handle) dlclose(gu.handle);
+	gu.handle = NULL;
 #endif
 }
\ No newline at end of file
@@ -32,6 +32,32 @@ static log_level 	*loglevel = &output_loglevel;
 // functions starting _* are called with mutex locked
 
 
+/*---------------------------------------------------------------------------*/
+static frames_t _output_threshold(frames_t frames, struct thread_ctx_s *ctx) {
+	frames_t threshold = ctx->output.threshold * ctx->output.current_sample_rate / 10;
+	u32_t elapsed, need, speed;
+
+	// stream statistics are a copy made under our own lock
+	if (!ctx->config.adaptive_start || ctx->output.adapt.samples < ADAPT_SAMPLES ||
+		!ctx->output.adapt.streaming) return threshold;
+
+	// audio received so far vs wall time, in 1/100 of realtime
+	elapsed = gettime_ms() - ctx->output.adapt.start;
+	speed = elapsed ? (u64_t) frames * 100000 / ((u64_t) ctx->output.current_sample_rate * elapsed) : 0;
+	need = ctx->output.adapt.prebuffer;
+
+	// slower than realtime, buffer also has to cover what's lost over the horizon
+	if (speed < 100) need += (u64_t) (100 - speed) * ADAPT_HORIZON / 100;
+
+	need = (u64_t) need * ctx->output.current_sample_rate / 1000;
+	if (speed >= ADAPT_MARGIN * 100 || need > threshold) threshold = need;
+
+	// never wait for more than outputbuf can hold
+	threshold = min(threshold, ctx->outputbuf->size / BYTES_PER_FRAME / 2);
+
+	return threshold;
+}
+
 /*---------------------------------------------------------------------------*/
 frames_t _output_frames(frames_t avail, struct thread_ctx_s *ctx) {
 
@@ -48,12 +74,19 @@ frames_t _output_frames(frames_t avail, struct thread_ctx_s *ctx) {
 	silence = false;
 
 	// start when threshold met
-	if (ctx->output.state == OUTPUT_BUFFER && frames > ctx->output.threshold * ctx->output.current_sample_rate / 10 && frames > ctx->output.start_frames) {
+	if (ctx->output.state == OUTPUT_BUFFER && frames > _output_threshold(frames, ctx) && frames > ctx->output.start_frames) {
 		ctx->output.state = OUTPUT_RUNNING;
-		LOG_INFO("[%p]: start buffer frames: %u", ctx, frames);
-		wake_controller(ctx);
+		LOG_INFO("[%p]: start buffer frames: %u (gap:%u jitter:%u prebuffer:%u ms)", ctx, frames,
+				 ctx->output.adapt.gap, ctx->output.adapt.jitter, ctx->output.adapt.prebuffer);
+		post_status(ctx, STATUS_OUTPUT);
 	}
 
+	// let controller know at once for end of track or underrun
+	if (ctx->output.state == OUTPUT_RUNNING && !frames && !ctx->output.drained) {
+		ctx->output.drained = true;
+		post_status(ctx, STATUS_OUTPUT);
+	} else if (frames) ctx->output.drained = false;
+
 	// skip ahead - consume outputbuf but play nothing
 	if (ctx->output.state == OUTPUT_SKIP_FRAMES) {
 		if (frames > 0) {
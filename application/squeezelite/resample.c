@@ -262,9 +262,8 @@ bool resample_init(char *opt, struct thread_ctx_s *ctx) {
 	char *atten = NULL;
 	char *precision = NULL, *passband_end = NULL, *stopband_begin = NULL, *phase_response = NULL;
 
-#if !LINKALL
-	if (!gr.handle) return false;
-#endif
+	// library is only loaded when the first player needs it
+	if (!library_load(&soxr_loaded, register_soxr)) return false;
 
 	r = ctx->decode.process_handle = malloc(sizeof(struct soxr));
 	if (!r) {
@@ -394,8 +393,10 @@ bool register_soxr(void) {
 
 void deregister_soxr(void) {
 #if !LINKALL
-	dlclose(gr.handle);
+	if (gr.handle) dlclose(gr.handle);
+	gr.handle = NULL;
 #endif
+	soxr_loaded = false;
 }
 
 
@@ -26,6 +26,48 @@
 #include "squeezelite.h"
 #include "slimproto.h"
 
+#if SLIMPROTO_REACTOR && LINUX
+#include <sys/epoll.h>
+#endif
+
+#define DISCOVERY_MAX		8
+#define DISCOVERY_RETRY		5000
+#define DISCOVERY_REFRESH	(60*1000)
+#define DISCOVERY_IDLE		1000		// ms without a player asking before an entry can be reused
+
+// discovery is shared by all players, per server asked for (0 is broadcast)
+static struct {
+	thread_type thread;
+	mutex_type mutex;
+	bool running;
+	sockfd sock;
+	int count;
+	struct discovery_s {
+		in_addr_t target;
+		bool found;
+		u32_t sent, last, used;
+		struct sockaddr_in server;
+		char version[SERVER_VERSION_LEN + 1];
+		char port[5+1];
+		u16_t cli_port;
+	} items[DISCOVERY_MAX];
+} discovery;
+
+#if SLIMPROTO_REACTOR
+enum { SLIM_IDLE = 0, SLIM_DISCOVER, SLIM_CONNECTING, SLIM_RETRY, SLIM_RUNNING };
+
+// one thread serves all players' slimproto connections
+static struct {
+	thread_type thread;
+	mutex_type mutex;
+	bool running;
+	event_event wake;
+#if LINUX
+	int efd;
+#endif
+} reactor;
+#endif
+
 #define PORT 3483
 #define MAXBUF 4096
 
@@ -82,6 +124,70 @@ void send_packet(u8_t *packet, size_t len, sockfd sock) {
 	}
 }
 
+/*---------------------------------------------------------------------------*/
+// send what socket takes now, rest waits for the controller to see it writable
+static void send_flush(struct thread_ctx_s *ctx) {
+	size_t sent = 0;
+
+	while (sent < ctx->sendq.len) {
+		ssize_t n = send(ctx->sock, ctx->sendq.buf + sent, ctx->sendq.len - sent, MSG_NOSIGNAL);
+
+		if (n <= 0) {
+			int error = last_error();
+#if WIN
+			if (n < 0 && (error == ERROR_WOULDBLOCK || error == WSAENOTCONN)) break;
+#else
+			if (n < 0 && error == ERROR_WOULDBLOCK) break;
+#endif
+			// connection is lost, reader will find out
+			LOG_WARN("[%p]: failed writing to socket: %s", ctx, strerror(error));
+			sent = ctx->sendq.len;
+			break;
+		}
+
+		sent += n;
+	}
+
+	if (!sent) return;
+
+	ctx->sendq.len -= sent;
+	memmove(ctx->sendq.buf, ctx->sendq.buf + sent, ctx->sendq.len);
+
+	// a partially sent STMt can't be overwritten anymore
+	if (ctx->sendq.stmt >= 0) ctx->sendq.stmt = ctx->sendq.stmt >= (int) sent ? ctx->sendq.stmt - sent : -1;
+}
+
+/*---------------------------------------------------------------------------*/
+// frames are queued whole or not at all, a partial one would desync LMS
+static bool send_room(struct thread_ctx_s *ctx, size_t len) {
+	if (ctx->sendq.len + len > SENDQ_MAX) {
+		LOG_WARN("[%p]: output queue full, dropping %zu bytes frame", ctx, len);
+		return false;
+	}
+
+	if (ctx->sendq.len + len > ctx->sendq.size) {
+		size_t size = min(max(ctx->sendq.size * 2, ctx->sendq.len + len), SENDQ_MAX);
+		u8_t *buf = realloc(ctx->sendq.buf, size);
+
+		if (!buf) {
+			LOG_WARN("[%p]: can't grow output queue, dropping %zu bytes frame", ctx, len);
+			return false;
+		}
+
+		ctx->sendq.buf = buf;
+		ctx->sendq.size = size;
+	}
+
+	return true;
+}
+
+/*---------------------------------------------------------------------------*/
+// caller has made room with send_room for the whole frame
+static void send_queue(struct thread_ctx_s *ctx, const void *data, size_t len) {
+	memcpy(ctx->sendq.buf + ctx->sendq.len, data, len);
+	ctx->sendq.len += len;
+}
+
 /*---------------------------------------------------------------------------*/
 static void sendHELO(bool reconnect, const char *fixed_cap, const char *var_cap, u8_t mac[6], struct thread_ctx_s *ctx) {
 	char *base_cap;
@@ -106,10 +212,13 @@ static void sendHELO(bool reconnect, const char *fixed_cap, const char *var_cap,
 	LOG_DEBUG("[%p] mac: %02x:%02x:%02x:%02x:%02x:%02x", ctx, pkt.mac[0], pkt.mac[1], pkt.mac[2], pkt.mac[3], pkt.mac[4], pkt.mac[5]);
 	LOG_INFO("[%p] cap: %s%s%s", ctx, base_cap, fixed_cap, var_cap);
 
-	send_packet((u8_t *)&pkt, sizeof(pkt), ctx->sock);
-	send_packet((u8_t *)base_cap, strlen(base_cap), ctx->sock);
-	send_packet((u8_t *)fixed_cap, strlen(fixed_cap), ctx->sock);
-	send_packet((u8_t *)var_cap, strlen(var_cap), ctx->sock);
+	if (send_room(ctx, sizeof(pkt) + strlen(base_cap) + strlen(fixed_cap) + strlen(var_cap))) {
+		send_queue(ctx, &pkt, sizeof(pkt));
+		send_queue(ctx, base_cap, strlen(base_cap));
+		send_queue(ctx, fixed_cap, strlen(fixed_cap));
+		send_queue(ctx, var_cap, strlen(var_cap));
+		send_flush(ctx);
+	}
 
 	free(base_cap);
 }
@@ -160,11 +269,22 @@ static void sendSTAT(const char *event, u32_t server_timestamp, struct thread_ct
 				   ms_played - now + ctx->status.stream_start, now - ctx->status.updated);
 	}
 
-	send_packet((u8_t *)&pkt, sizeof(pkt), ctx->sock);
+	// latest timer status supersedes one still waiting to be sent
+	if (!memcmp(event, "STMt", 4) && ctx->sendq.stmt >= 0) {
+		memcpy(ctx->sendq.buf + ctx->sendq.stmt, &pkt, sizeof(pkt));
+		LOG_DEBUG("[%p]: STMt coalesced", ctx);
+		return;
+	}
+
+	if (!send_room(ctx, sizeof(pkt))) return;
+	if (!memcmp(event, "STMt", 4)) ctx->sendq.stmt = ctx->sendq.len;
+
+	send_queue(ctx, &pkt, sizeof(pkt));
+	send_flush(ctx);
 }
 
 /*---------------------------------------------------------------------------*/
-static void sendDSCO(disconnect_code disconnect, sockfd sock) {
+static void sendDSCO(disconnect_code disconnect, struct thread_ctx_s *ctx) {
 	struct DSCO_packet pkt;
 
 	memset(&pkt, 0, sizeof(pkt));
@@ -172,41 +292,47 @@ static void sendDSCO(disconnect_code disconnect, sockfd sock) {
 	pkt.length = htonl(sizeof(pkt) - 8);
 	pkt.reason = disconnect & 0xFF;
 
-	LOG_DEBUG("[%d]: DSCO: %d", sock, disconnect);
+	LOG_DEBUG("[%p]: DSCO: %d", ctx, disconnect);
 
-	send_packet((u8_t *)&pkt, sizeof(pkt), sock);
+	if (!send_room(ctx, sizeof(pkt))) return;
+	send_queue(ctx, &pkt, sizeof(pkt));
+	send_flush(ctx);
 }
 
 /*---------------------------------------------------------------------------*/
-static void sendRESP(const char *header, size_t len, sockfd sock) {
+static void sendRESP(const char *header, size_t len, struct thread_ctx_s *ctx) {
 	struct RESP_header pkt_header;
 
 	memset(&pkt_header, 0, sizeof(pkt_header));
 	memcpy(&pkt_header.opcode, "RESP", 4);
 	pkt_header.length = htonl(sizeof(pkt_header) + len - 8);
 
-	LOG_DEBUG("[%d]: RESP", sock);
+	LOG_DEBUG("[%p]: RESP", ctx);
 
-	send_packet((u8_t *)&pkt_header, sizeof(pkt_header), sock);
-	send_packet((u8_t *)header, len, sock);
+	if (!send_room(ctx, sizeof(pkt_header) + len)) return;
+	send_queue(ctx, &pkt_header, sizeof(pkt_header));
+	send_queue(ctx, header, len);
+	send_flush(ctx);
 }
 
 /*---------------------------------------------------------------------------*/
-static void sendMETA(const char *meta, size_t len, sockfd sock) {
+static void sendMETA(const char *meta, size_t len, struct thread_ctx_s *ctx) {
 	struct META_header pkt_header;
 
 	memset(&pkt_header, 0, sizeof(pkt_header));
 	memcpy(&pkt_header.opcode, "META", 4);
 	pkt_header.length = htonl(sizeof(pkt_header) + len - 8);
 
-	LOG_DEBUG("[%d]: META", sock);
+	LOG_DEBUG("[%p]: META", ctx);
 
-	send_packet((u8_t *)&pkt_header, sizeof(pkt_header), sock);
-	send_packet((u8_t *)meta, len, sock);
+	if (!send_room(ctx, sizeof(pkt_header) + len)) return;
+	send_queue(ctx, &pkt_header, sizeof(pkt_header));
+	send_queue(ctx, meta, len);
+	send_flush(ctx);
 }
 
 /*---------------------------------------------------------------------------*/
-static void sendSETDName(const char *name, sockfd sock) {
+static void sendSETDName(const char *name, struct thread_ctx_s *ctx) {
 	struct SETD_header pkt_header;
 
 	memset(&pkt_header, 0, sizeof(pkt_header));
@@ -215,10 +341,12 @@ static void sendSETDName(const char *name, sockfd sock) {
 	pkt_header.id = 0; // id 0 is playername S:P:Squeezebox2
 	pkt_header.length = htonl(sizeof(pkt_header) + strlen(name) + 1 - 8);
 
-	LOG_DEBUG("[%d]: set playername: %s", sock, name);
+	LOG_DEBUG("[%p]: set playername: %s", ctx, name);
 
-	send_packet((u8_t *)&pkt_header, sizeof(pkt_header), sock);
-	send_packet((u8_t *)name, strlen(name) + 1, sock);
+	if (!send_room(ctx, sizeof(pkt_header) + strlen(name) + 1)) return;
+	send_queue(ctx, &pkt_header, sizeof(pkt_header));
+	send_queue(ctx, name, strlen(name) + 1);
+	send_flush(ctx);
 }
 
 
@@ -348,9 +476,15 @@ static void process_strm(u8_t *pkt, int len, struct thread_ctx_s *ctx) {
 			// TODO: must be changed if one day direct streaming is enabled
 			ctx->callback(ctx->MR, SQ_CONNECT);
 
-			stream_sock(ip, strm->server_port, strm->flags & 0x20, 
-				        strm->format == 'o' || strm->format == 'u' || (strm->format == 'f' && strm->pcm_sample_size == 'o'),
-						header, header_len, strm->threshold * 1024, ctx->autostart >= 2, ctx);
+			if (ip == LOCAL_PLAYER_IP && strm->server_port == LOCAL_PLAYER_PORT) {
+				// extension to slimproto for LocalPlayer - header is filename not http header, don't expect cont
+				stream_file(header, header_len, strm->threshold * 1024, ctx);
+				if (ctx->autostart > 1) ctx->autostart -= 2;
+			} else {
+				stream_sock(ip, strm->server_port, strm->flags & 0x20,
+							strm->format == 'o' || strm->format == 'u' || (strm->format == 'f' && strm->pcm_sample_size == 'o'),
+							header, header_len, strm->threshold * 1024, ctx->autostart >= 2, ctx);
+			}
 
 			sendSTAT("STMc", 0, ctx);
 			ctx->sentSTMu = ctx->sentSTMo = ctx->sentSTMl = ctx->sentSTMd = false;
@@ -452,14 +586,14 @@ static void process_setd(u8_t *pkt, int len,struct thread_ctx_s *ctx) {
 	if (setd->id == 0) {
 		if (len == 5) {
 			if (strlen(ctx->config.name)) {
-				sendSETDName(ctx->config.name, ctx->sock);
+				sendSETDName(ctx->config.name, ctx);
 			}
 		} else if (len > 5) {
 			strncpy(ctx->config.name, setd->data, STR_LEN);
 			ctx->config.name[STR_LEN - 1] = '\0';
 			LOG_DEBUG("[%p] set name: %s", ctx, setd->data);
 			// confirm change to server
-			sendSETDName(setd->data, ctx->sock);
+			sendSETDName(setd->data, ctx);
 			ctx->callback(ctx->MR, SQ_SETNAME, ctx->config.name);
 		}
 	}
@@ -538,293 +672,543 @@ static void process(u8_t *pack, int len, struct thread_ctx_s *ctx) {
 	}
 }
 
+/*---------------------------------------------------------------------------*/
+// one read step, frames are assembled in slim_run.buffer across calls
+static int slimproto_read(struct thread_ctx_s *ctx) {
+	int n;
+
+	if (ctx->slim_run.expect > 0) {
+		n = recv(ctx->sock, ctx->slim_run.buffer + ctx->slim_run.got, ctx->slim_run.expect, 0);
+	} else if (ctx->slim_run.expect == 0) {
+		n = recv(ctx->sock, ctx->slim_run.buffer + ctx->slim_run.got, 2 - ctx->slim_run.got, 0);
+	} else {
+		LOG_ERROR("[%p] FATAL: negative expect", ctx);
+		return -1;
+	}
+
+	if (n <= 0) {
+		if (n < 0 && last_error() == ERROR_WOULDBLOCK) return 0;
+		LOG_WARN("[%p] error reading from socket: %s", ctx, n ? strerror(last_error()) : "closed");
+		return -1;
+	}
+
+	ctx->slim_run.got += n;
+
+	if (ctx->slim_run.expect > 0) {
+		ctx->slim_run.expect -= n;
+		if (ctx->slim_run.expect == 0) {
+			process(ctx->slim_run.buffer, ctx->slim_run.got, ctx);
+			ctx->slim_run.got = 0;
+		}
+	} else if (ctx->slim_run.got == 2) {
+		ctx->slim_run.expect = ctx->slim_run.buffer[0] << 8 | ctx->slim_run.buffer[1]; // length pack 'n'
+		ctx->slim_run.got = 0;
+		if (ctx->slim_run.expect > MAXBUF) {
+			LOG_ERROR("[%p] FATAL: slimproto packet too big: %d > %d", ctx, ctx->slim_run.expect, MAXBUF);
+			return -1;
+		}
+	}
+
+	return n;
+}
+
+/*---------------------------------------------------------------------------*/
+// update playback state for what events say has changed
+static void slimproto_status(struct thread_ctx_s *ctx, u32_t events, u32_t now) {
+	bool _sendSTMs = false;
+	bool _sendDSCO = false;
+	bool _sendRESP = false;
+	bool _sendMETA = false;
+	bool _sendSTMd = false;
+	bool _sendSTMt = false;
+	bool _sendSTMl = false;
+	bool _sendSTMu = false;
+	bool _sendSTMo = false;
+	bool _sendSTMn = false;
+	bool _stream_disconnect = false;
+	bool active = false;
+	disconnect_code disconnect_code;
+	size_t header_len = 0;
+
+	if (events == STATUS_ALL) ctx->slim_run.last = now;
+
+	if (events & STATUS_STREAM) {
+		LOCK_S;
+		ctx->status.stream_full = _buf_used(ctx->streambuf);
+		ctx->status.stream_size = ctx->streambuf->size;
+		ctx->status.stream_bytes = ctx->stream.bytes;
+		ctx->status.stream_state = ctx->stream.state;
+
+		if (ctx->stream.state == DISCONNECT) {
+			disconnect_code = ctx->stream.disconnect;
+			ctx->stream.state = STOPPED;
+			_sendDSCO = true;
+		}
+
+		if (!ctx->stream.sent_headers &&
+			(ctx->stream.state == STREAMING_HTTP || ctx->stream.state == STREAMING_WAIT || ctx->stream.state == STREAMING_BUFFERING)) {
+			header_len = ctx->stream.header_len;
+			memcpy(ctx->slim_run.header, ctx->stream.header, header_len);
+			_sendRESP = true;
+			ctx->stream.sent_headers = true;
+		}
+		if (ctx->stream.meta_send) {
+			header_len = ctx->stream.header_len;
+			memcpy(ctx->slim_run.header, ctx->stream.header, header_len);
+			_sendMETA = true;
+			ctx->stream.meta_send = false;
+			ctx->callback(ctx->MR, SQ_METASEND);
+		}
+		UNLOCK_S;
+	}
+
+	// stream state matters for output end and underrun
+	if (events & (STATUS_STREAM | STATUS_OUTPUT | STATUS_TRACK)) {
+		LOCK_O;
+		ctx->status.output_full = _buf_used(ctx->outputbuf);
+		ctx->status.output_size = ctx->outputbuf->size;
+		ctx->status.frames_played = ctx->output.frames_played_dmp;
+		ctx->status.current_sample_rate = ctx->output.current_sample_rate;
+		ctx->status.updated = ctx->output.updated;
+		ctx->status.device_frames = ctx->output.device_frames;
+
+		if (ctx->output.track_started) {
+			_sendSTMs = true;
+			ctx->output.track_started = false;
+			ctx->status.stream_start = ctx->output.track_start_time;
+			ctx->callback(ctx->MR, SQ_STARTED, ctx->output.track_start_time);
+		}
+
+		if (ctx->output.state == OUTPUT_RUNNING && !ctx->sentSTMu && ctx->status.output_full == 0 && ctx->status.stream_state <= DISCONNECT) {
+			_sendSTMu = true;
+			ctx->sentSTMu = true;
+			ctx->callback(ctx->MR, SQ_FINISHED);
+		}
+		if (ctx->output.state == OUTPUT_RUNNING && !ctx->sentSTMo && ctx->status.output_full == 0 && ctx->status.stream_state == STREAMING_HTTP) {
+			_sendSTMo = true;
+			ctx->sentSTMo = true;
+			LOG_WARN("[%p]: output underrun", ctx);
+		}
+		if (ctx->output.state > OUTPUT_STOPPED) active = true;
+		UNLOCK_O;
+	}
+
+	// stream state matters for decoder start
+	if (events & (STATUS_STREAM | STATUS_DECODE)) {
+		LOCK_D;
+
+		if (ctx->decode.state == DECODE_RUNNING && now - ctx->status.last > 1000) {
+			_sendSTMt = true;
+			ctx->status.last = now;
+		}
+
+		if ((ctx->status.stream_state == STREAMING_HTTP || ctx->status.stream_state == STREAMING_FILE || (ctx->status.stream_state == DISCONNECT && ctx->stream.disconnect == DISCONNECT_OK))
+			&& !ctx->sentSTMl && ctx->decode.state == DECODE_READY) {
+			if (ctx->autostart == 0) {
+				ctx->decode.state = DECODE_RUNNING;
+				_sendSTMl = true;
+				ctx->sentSTMl = true;
+			} else if (ctx->autostart == 1) {
+				ctx->decode.state = DECODE_RUNNING;
+				LOCK_O;
+				if (ctx->output.state == OUTPUT_STOPPED) {
+					ctx->output.state = OUTPUT_BUFFER;
+				}
+				UNLOCK_O;
+			}
+			// autostart 2 and 3 require cont to be received first
+		}
+		if (ctx->decode.state == DECODE_COMPLETE || ctx->decode.state == DECODE_ERROR) {
+			if (ctx->decode.state == DECODE_COMPLETE) _sendSTMd = true;
+			if (ctx->decode.state == DECODE_ERROR)    _sendSTMn = true;
+			ctx->decode.state = DECODE_STOPPED;
+			if (ctx->status.stream_state == STREAMING_HTTP || ctx->status.stream_state == STREAMING_FILE) {
+				_stream_disconnect = true;
+			}
+		}
+		if (ctx->decode.state != DECODE_STOPPED) active = true;
+		UNLOCK_D;
+	}
+
+	// idle players are only swept on events
+	if (ctx->status.stream_state > STOPPED) active = true;
+	if (events == STATUS_ALL) ctx->slim_run.active = active;
+	else ctx->slim_run.active |= active;
+
+	if (_stream_disconnect) stream_disconnect(ctx);
+
+	// send packets once locks released as packet sending can block
+	if (_sendDSCO) sendDSCO(disconnect_code, ctx);
+	if (_sendSTMs) sendSTAT("STMs", 0, ctx);
+	if (_sendSTMt) sendSTAT("STMt", 0, ctx);
+	if (_sendSTMl) sendSTAT("STMl", 0, ctx);
+	if (_sendSTMd) sendSTAT("STMd", 0, ctx);
+	if (_sendSTMu) sendSTAT("STMu", 0, ctx);
+	if (_sendSTMo) sendSTAT("STMo", 0, ctx);
+	if (_sendSTMn) sendSTAT("STMn", 0, ctx);
+	if (_sendRESP) sendRESP(ctx->slim_run.header, header_len, ctx);
+	if (_sendMETA) sendMETA(ctx->slim_run.header, header_len, ctx);
+}
+
+#if !SLIMPROTO_REACTOR
 /*---------------------------------------------------------------------------*/
 static void slimproto_run(struct thread_ctx_s *ctx) {
-	int  expect = 0;
-	int  got    = 0;
 	u32_t now;
 	event_handle ehandles[2];
 	int timeouts = 0;
 
+	ctx->slim_run.expect = ctx->slim_run.got = 0;
 	set_readwake_handles(ehandles, ctx->sock, ctx->wake_e);
 
 	while (ctx->running && !ctx->new_server) {
 		bool wake = false;
 		event_type ev;
+		u32_t events;
+		int wait = ctx->slim_run.active ? STATUS_PERIOD : 1000;
 
-		if ((ev = wait_readwake(ehandles, 1000)) != EVENT_TIMEOUT) {
+#if WINEVENT
+		// socket being writable is not part of what we wait for
+		if (ctx->sendq.len) wait = 10;
+#else
+		ehandles[0].events = ctx->sendq.len ? POLLIN | POLLOUT : POLLIN;
+#endif
+		ev = wait_readwake(ehandles, wait);
+		if (ctx->sendq.len) send_flush(ctx);
 
-			if (ev == EVENT_READ) {
+		// socket was only writable, queue has just been flushed
+		if (ev == EVENT_WRITE) {
+			ev = EVENT_TIMEOUT;
+			wait = 0;
+		}
 
-				if (expect > 0) {
-					int n = recv(ctx->sock, ctx->slim_run.buffer + got, expect, 0);
-					if (n <= 0) {
-						if (n < 0 && last_error() == ERROR_WOULDBLOCK) {
-							continue;
-						}
-						LOG_WARN("[%p] error reading from socket: %s", ctx, n ? strerror(last_error()) : "closed");
-						return;
-					}
-					expect -= n;
-					got += n;
-					if (expect == 0) {
-						process(ctx->slim_run.buffer, got, ctx);
-						got = 0;
-					}
-				} else if (expect == 0) {
-					int n = recv(ctx->sock, ctx->slim_run.buffer + got, 2 - got, 0);
-					if (n <= 0) {
-						if (n < 0 && last_error() == ERROR_WOULDBLOCK) {
-							continue;
-						}
-						LOG_WARN("[%p] error reading from socket: %s", ctx, n ? strerror(last_error()) : "closed");
-						return;
-					}
-					got += n;
-					if (got == 2) {
-						expect = ctx->slim_run.buffer[0] << 8 | ctx->slim_run.buffer[1]; // length pack 'n'
-						got = 0;
-						if (expect > MAXBUF) {
-							LOG_ERROR("[%p] FATAL: slimproto packet too big: %d > %d", ctx, expect, MAXBUF);
-							return;
-						}
-					}
-				} else {
-					LOG_ERROR("[%p] FATAL: negative expect", ctx);
-					return;
-				}
+		if (ev != EVENT_TIMEOUT) {
 
+			if (ev == EVENT_READ) {
+				int n = slimproto_read(ctx);
+				if (n < 0) return;
+				if (n == 0) continue;
 			}
 
 			if (ev == EVENT_WAKE) {
 				wake = true;
 			}
 
-			if (ctx->cli_sock > 0 && (int) (gettime_ms() - ctx->cli_timeout) > 0) {
-				if (!mutex_trylock(ctx->cli_mutex)) {
-					LOG_INFO("[%p] Closing CLI socket %d", ctx, ctx->cli_sock);
-					closesocket(ctx->cli_sock);
-					ctx->cli_sock = -1;
-					mutex_unlock(ctx->cli_mutex);
-				}
-			}
-
 			timeouts = 0;
 
-		} else if (++timeouts > 35) {
+		} else if ((timeouts += wait) > 35 * 1000) {
 
 			// expect message from server every 5 seconds, but 30 seconds on mysb.com so timeout after 35 seconds
 			LOG_WARN("[%p] No messages from server - connection dead", ctx);
 			return;
 		}
 
-		// update playback state when woken or every 100ms
+		// update playback state on posted events, after server commands or periodically when active
 		now = gettime_ms();
+		events = wake ? atomic_xchg(&ctx->events, 0) : 0;
 
-		if (wake || now - ctx->slim_run.last > 100 || ctx->slim_run.last > now) {
-			bool _sendSTMs = false;
-			bool _sendDSCO = false;
-			bool _sendRESP = false;
-			bool _sendMETA = false;
-			bool _sendSTMd = false;
-			bool _sendSTMt = false;
-			bool _sendSTMl = false;
-			bool _sendSTMu = false;
-			bool _sendSTMo = false;
-			bool _sendSTMn = false;
-			bool _stream_disconnect = false;
-			disconnect_code disconnect_code;
-			size_t header_len = 0;
-			ctx->slim_run.last = now;
-
-			LOCK_S;
-			ctx->status.stream_full = _buf_used(ctx->streambuf);
-			ctx->status.stream_size = ctx->streambuf->size;
-			ctx->status.stream_bytes = ctx->stream.bytes;
-			ctx->status.stream_state = ctx->stream.state;
-
-			if (ctx->stream.state == DISCONNECT) {
-				disconnect_code = ctx->stream.disconnect;
-				ctx->stream.state = STOPPED;
-				_sendDSCO = true;
-			}
-
-			if (!ctx->stream.sent_headers &&
-				(ctx->stream.state == STREAMING_HTTP || ctx->stream.state == STREAMING_WAIT || ctx->stream.state == STREAMING_BUFFERING)) {
-				header_len = ctx->stream.header_len;
-				memcpy(ctx->slim_run.header, ctx->stream.header, header_len);
-				_sendRESP = true;
-				ctx->stream.sent_headers = true;
-			}
-			if (ctx->stream.meta_send) {
-				header_len = ctx->stream.header_len;
-				memcpy(ctx->slim_run.header, ctx->stream.header, header_len);
-				_sendMETA = true;
-				ctx->stream.meta_send = false;
-				ctx->callback(ctx->MR, SQ_METASEND);
-			}
-			UNLOCK_S;
-
-			LOCK_O;
-			ctx->status.output_full = _buf_used(ctx->outputbuf);
-			ctx->status.output_size = ctx->outputbuf->size;
-			ctx->status.frames_played = ctx->output.frames_played_dmp;
-			ctx->status.current_sample_rate = ctx->output.current_sample_rate;
-			ctx->status.updated = ctx->output.updated;
-			ctx->status.device_frames = ctx->output.device_frames;
-
-			if (ctx->output.track_started) {
-				_sendSTMs = true;
-				ctx->output.track_started = false;
-				ctx->status.stream_start = ctx->output.track_start_time;
-				ctx->callback(ctx->MR, SQ_STARTED, ctx->output.track_start_time);
-			}
-
-			if (ctx->output.state == OUTPUT_RUNNING && !ctx->sentSTMu && ctx->status.output_full == 0 && ctx->status.stream_state <= DISCONNECT) {
-				_sendSTMu = true;
-				ctx->sentSTMu = true;
-				ctx->callback(ctx->MR, SQ_FINISHED);
-			}
-			if (ctx->output.state == OUTPUT_RUNNING && !ctx->sentSTMo && ctx->status.output_full == 0 && ctx->status.stream_state == STREAMING_HTTP) {
-				_sendSTMo = true;
-				ctx->sentSTMo = true;
-				LOG_WARN("[%p]: output underrun", ctx);
-			}
-			UNLOCK_O;
-
-			LOCK_D;
-
-			if (ctx->decode.state == DECODE_RUNNING && now - ctx->status.last > 1000) {
-				_sendSTMt = true;
-				ctx->status.last = now;
-			}
-
-			if ((ctx->status.stream_state == STREAMING_HTTP || ctx->status.stream_state == STREAMING_FILE || (ctx->status.stream_state == DISCONNECT && ctx->stream.disconnect == DISCONNECT_OK))
-				&& !ctx->sentSTMl && ctx->decode.state == DECODE_READY) {
-				if (ctx->autostart == 0) {
-					ctx->decode.state = DECODE_RUNNING;
-					_sendSTMl = true;
-					ctx->sentSTMl = true;
-				} else if (ctx->autostart == 1) {
-					ctx->decode.state = DECODE_RUNNING;
-					LOCK_O;
-					if (ctx->output.state == OUTPUT_STOPPED) {
-						ctx->output.state = OUTPUT_BUFFER;
-					}
-					UNLOCK_O;
-				}
-				// autostart 2 and 3 require cont to be received first
-			}
-			if (ctx->decode.state == DECODE_COMPLETE || ctx->decode.state == DECODE_ERROR) {
-				if (ctx->decode.state == DECODE_COMPLETE) _sendSTMd = true;
-				if (ctx->decode.state == DECODE_ERROR)    _sendSTMn = true;
-				ctx->decode.state = DECODE_STOPPED;
-				if (ctx->status.stream_state == STREAMING_HTTP || ctx->status.stream_state == STREAMING_FILE) {
-					_stream_disconnect = true;
-				}
-			}
-			UNLOCK_D;
-
-			if (_stream_disconnect) stream_disconnect(ctx);
-
-			// send packets once locks released as packet sending can block
-			if (_sendDSCO) sendDSCO(disconnect_code, ctx->sock);
-			if (_sendSTMs) sendSTAT("STMs", 0, ctx);
-			if (_sendSTMt) sendSTAT("STMt", 0, ctx);
-			if (_sendSTMl) sendSTAT("STMl", 0, ctx);
-			if (_sendSTMd) sendSTAT("STMd", 0, ctx);
-			if (_sendSTMu) sendSTAT("STMu", 0, ctx);
-			if (_sendSTMo) sendSTAT("STMo", 0, ctx);
-			if (_sendSTMn) sendSTAT("STMn", 0, ctx);
-			if (_sendRESP) sendRESP(ctx->slim_run.header, header_len, ctx->sock);
-			if (_sendMETA) sendMETA(ctx->slim_run.header, header_len, ctx->sock);
+		if (ev == EVENT_READ || (ctx->slim_run.active && (now - ctx->slim_run.last > STATUS_PERIOD || ctx->slim_run.last > now))) {
+			events = STATUS_ALL;
 		}
+
+		if (events) slimproto_status(ctx, events, now);
 	}
 }
+#endif
 
  /*---------------------------------------------------------------------------*/
 // called from other threads to wake state machine above
 void wake_controller(struct thread_ctx_s *ctx) {
+	post_status(ctx, STATUS_ALL);
+}
+
+/*---------------------------------------------------------------------------*/
+// lock-free, events accumulate until the controller picks them all at once
+void post_status(struct thread_ctx_s *ctx, u32_t events) {
+	atomic_or(&ctx->events, events);
 	wake_signal(ctx->wake_e);
 }
 
-void discover_server(struct thread_ctx_s *ctx) {
-	struct sockaddr_in d;
-	struct sockaddr_in s;
+/*---------------------------------------------------------------------------*/
+static void discovery_send(struct discovery_s *item, u32_t now) {
 	char buf[32], vers[] = "VERS", port[] = "JSON", clip[] = "CLIP";
-	struct pollfd pollinfo;
-	u8_t len;
-	int disc_sock = socket(AF_INET, SOCK_DGRAM, 0);
-	socklen_t enable = 1;
-
-	ctx->cli_port = 9090;
-	setsockopt(disc_sock, SOL_SOCKET, SO_BROADCAST, (const void *)&enable, sizeof(enable));
-	len = sprintf(buf,"e%s%c%s%c%s", vers, '\0', port, '\0', clip) + 1;
+	u8_t len = sprintf(buf,"e%s%c%s%c%s", vers, '\0', port, '\0', clip) + 1;
+	struct sockaddr_in d;
 
 	memset(&d, 0, sizeof(d));
 	d.sin_family = AF_INET;
 	d.sin_port = htons(PORT);
-	if (!ctx->slimproto_ip) {
-		// some systems refuse to broadcast on unbound socket
-		memset(&s, 0, sizeof(s));
-		s.sin_addr.s_addr = sq_local_host.s_addr;
-		s.sin_family = AF_INET;
-		bind(disc_sock, (struct sockaddr*) &s, sizeof(s));
-		d.sin_addr.s_addr = htonl(INADDR_BROADCAST);
-	} else {
-		d.sin_addr.s_addr = ctx->slimproto_ip;
+	d.sin_addr.s_addr = item->target ? item->target : htonl(INADDR_BROADCAST);
+
+	LOG_DEBUG("sending discovery to %s", inet_ntoa(d.sin_addr));
+
+	if (sendto(discovery.sock, buf, len, 0, (struct sockaddr *) &d, sizeof(d)) < 0) {
+		LOG_WARN("error sending discovery", NULL);
+	}
+
+	item->sent = now;
+}
+
+/*---------------------------------------------------------------------------*/
+static void discovery_parse(char *readbuf, struct sockaddr_in *s, struct discovery_s *item, u32_t now) {
+	char *p, vers[] = "VERS", port[] = "JSON", clip[] = "CLIP";
+
+	item->cli_port = 9090;
+	*item->version = *item->port = '\0';
+
+	if ((p = strstr(readbuf, vers)) != NULL) {
+		p += strlen(vers);
+		strncpy(item->version, p + 1, min(SERVER_VERSION_LEN, *p));
+		item->version[min(SERVER_VERSION_LEN, *p)] = '\0';
+	}
+
+	 if ((p = strstr(readbuf, port)) != NULL) {
+		p += strlen(port);
+		strncpy(item->port, p + 1, min(5, *p));
+		item->port[min(5, *p)] = '\0';
 	}
 
-	pollinfo.fd = disc_sock;
-	pollinfo.events = POLLIN;
+	 if ((p = strstr(readbuf, clip)) != NULL) {
+		p += strlen(clip);
+		item->cli_port = atoi(p + 1);
+	}
 
-	do {
-		LOG_DEBUG("[%p] sending discovery", ctx);
-		memset(&s, 0, sizeof(s));
+	if (!item->found || item->server.sin_addr.s_addr != s->sin_addr.s_addr) {
+		LOG_INFO("found server %s:%d (version %s)", inet_ntoa(s->sin_addr), ntohs(s->sin_port), item->version);
+	}
 
-		if (sendto(disc_sock, buf, len, 0, (struct sockaddr *)&d, sizeof(d)) < 0) {
-			LOG_WARN("[%p] error sending discovery", ctx);
+	item->server = *s;
+	item->found = true;
+	item->last = now;
+}
+
+/*---------------------------------------------------------------------------*/
+// one socket probes every server asked for and keeps answers fresh
+static void *discovery_thread(void *arg) {
+	while (discovery.running) {
+		struct pollfd pollinfo;
+		int i, timeout = DISCOVERY_RETRY;
+		u32_t now = gettime_ms();
+
+		mutex_lock(discovery.mutex);
+
+		for (i = 0; i < discovery.count; i++) {
+			struct discovery_s *item = discovery.items + i;
+			u32_t period = item->found ? DISCOVERY_REFRESH : DISCOVERY_RETRY;
+			s32_t wait = item->sent + period - now;
+
+			if (wait <= 0) {
+				discovery_send(item, now);
+				wait = period;
+			}
+
+			if (wait < timeout) timeout = wait;
 		}
 
-		if (poll(&pollinfo, 1, 5000) == 1) {
-			char readbuf[128], *p;
+		mutex_unlock(discovery.mutex);
+
+		pollinfo.fd = discovery.sock;
+		pollinfo.events = POLLIN;
 
+		// cap so that shutdown is not delayed
+		if (poll(&pollinfo, 1, min(timeout, 1000)) == 1) {
+			char readbuf[128];
+			struct sockaddr_in s;
 			socklen_t slen = sizeof(s);
+
 			memset(readbuf, 0, sizeof(readbuf));
-			recvfrom(disc_sock, readbuf, sizeof(readbuf) - 1, 0, (struct sockaddr *)&s, &slen);
+			if (recvfrom(discovery.sock, readbuf, sizeof(readbuf) - 1, 0, (struct sockaddr *) &s, &slen) <= 0) continue;
 
-			if ((p = strstr(readbuf, vers)) != NULL) {
-				p += strlen(vers);
-				strncpy(ctx->server_version, p + 1, min(SERVER_VERSION_LEN, *p));
-				ctx->server_version[min(SERVER_VERSION_LEN, *p)] = '\0';
-			}
+			LOG_DEBUG("got response from: %s:%d", inet_ntoa(s.sin_addr), ntohs(s.sin_port));
+			now = gettime_ms();
+
+			mutex_lock(discovery.mutex);
 
-			 if ((p = strstr(readbuf, port)) != NULL) {
-				p += strlen(port);
-				strncpy(ctx->server_port, p + 1, min(5, *p));
-				ctx->server_port[min(6, *p)] = '\0';
+			// broadcast takes first answer, a server always answers its own probe
+			for (i = 0; i < discovery.count; i++) {
+				struct discovery_s *item = discovery.items + i;
+
+				if (item->target == s.sin_addr.s_addr ||
+					(!item->target && (!item->found || item->server.sin_addr.s_addr == s.sin_addr.s_addr))) {
+					discovery_parse(readbuf, &s, item, now);
+				}
 			}
 
-			 if ((p = strstr(readbuf, clip)) != NULL) {
-				p += strlen(clip);
-				ctx->cli_port = atoi(p + 1);
+			mutex_unlock(discovery.mutex);
+
+#if SLIMPROTO_REACTOR
+			// players waiting for discovery are polled by the reactor
+			wake_signal(reactor.wake);
+#endif
+		}
+	}
+
+	return NULL;
+}
+
+/*---------------------------------------------------------------------------*/
+static void discovery_init(void) {
+	struct sockaddr_in s;
+	socklen_t enable = 1;
+	pthread_attr_t attr;
+
+	mutex_create(discovery.mutex);
+	discovery.count = 0;
+
+	// some systems refuse to broadcast on unbound socket
+	discovery.sock = socket(AF_INET, SOCK_DGRAM, 0);
+	setsockopt(discovery.sock, SOL_SOCKET, SO_BROADCAST, (const void *)&enable, sizeof(enable));
+	memset(&s, 0, sizeof(s));
+	s.sin_addr.s_addr = sq_local_host.s_addr;
+	s.sin_family = AF_INET;
+	bind(discovery.sock, (struct sockaddr*) &s, sizeof(s));
+
+	discovery.running = true;
+	pthread_attr_init(&attr);
+	pthread_attr_setstacksize(&attr, PTHREAD_STACK_MIN + SLIMPROTO_THREAD_STACK_SIZE);
+	pthread_create(&discovery.thread, &attr, discovery_thread, NULL);
+	pthread_attr_destroy(&attr);
+}
+
+/*---------------------------------------------------------------------------*/
+static void discovery_end(void) {
+	discovery.running = false;
+	pthread_join(discovery.thread, NULL);
+	closesocket(discovery.sock);
+	mutex_destroy(discovery.mutex);
+}
+
+/*---------------------------------------------------------------------------*/
+// fills player with what is known about its server, or starts looking for it
+static bool discovery_get(struct thread_ctx_s *ctx) {
+	struct discovery_s *item = NULL;
+	u32_t now = gettime_ms();
+	bool found = false, fresh = false;
+	int i;
+
+	mutex_lock(discovery.mutex);
+
+	for (i = 0; i < discovery.count && !item; i++) {
+		if (discovery.items[i].target == ctx->slimproto_ip) item = discovery.items + i;
+	}
+
+	if (!item && discovery.count < DISCOVERY_MAX) {
+		item = discovery.items + discovery.count++;
+		fresh = true;
+	} else if (!item) {
+		// table is full, re-use the entry nobody has asked for the longest
+		for (i = 0; i < discovery.count; i++) {
+			struct discovery_s *p = discovery.items + i;
+			if (now - p->used > DISCOVERY_IDLE && (!item || (s32_t) (p->used - item->used) < 0)) item = p;
+		}
+		// all are in use, caller retries so slots get freed as other searches end
+		if (!item) {
+			static u32_t warned;
+			if (now - warned > DISCOVERY_RETRY) {
+				LOG_ERROR("[%p]: too many servers searched at once (max:%d)", ctx, DISCOVERY_MAX);
+				warned = now;
 			}
+			mutex_unlock(discovery.mutex);
+			return false;
+		}
+		LOG_INFO("[%p]: re-using discovery slot of an idle search", ctx);
+		fresh = true;
+	}
+
+	if (fresh) {
+		memset(item, 0, sizeof(*item));
+		item->target = ctx->slimproto_ip;
+		discovery_send(item, now);
+	}
+
+	item->used = now | 0x01;
+
+	if (item->found) {
+		strcpy(ctx->server_version, item->version);
+		strcpy(ctx->server_port, item->port);
+		strcpy(ctx->server_ip, inet_ntoa(item->server.sin_addr));
+		ctx->cli_port = item->cli_port;
+
+		ctx->slimproto_ip = item->server.sin_addr.s_addr;
+		ctx->slimproto_port = ntohs(item->server.sin_port);
+
+		ctx->serv_addr.sin_port = item->server.sin_port;
+		ctx->serv_addr.sin_addr.s_addr = item->server.sin_addr.s_addr;
+		ctx->serv_addr.sin_family = AF_INET;
+		found = true;
+	}
+
+	mutex_unlock(discovery.mutex);
 
-			strcpy(ctx->server_ip, inet_ntoa(s.sin_addr));
-			LOG_DEBUG("[%p] got response from: %s:%d", ctx, inet_ntoa(s.sin_addr), ntohs(s.sin_port));
+	return found;
+}
+
+/*---------------------------------------------------------------------------*/
+// a server that can't be reached must be searched again
+static void discovery_forget(in_addr_t server) {
+	int i;
+
+	mutex_lock(discovery.mutex);
+
+	for (i = 0; i < discovery.count; i++) {
+		struct discovery_s *item = discovery.items + i;
+
+		if (item->found && item->server.sin_addr.s_addr == server) {
+			item->found = false;
+			discovery_send(item, gettime_ms());
 		}
-	} while (s.sin_addr.s_addr == 0 && ctx->running);
+	}
+
+	mutex_unlock(discovery.mutex);
+}
+
+/*---------------------------------------------------------------------------*/
+void discover_server(struct thread_ctx_s *ctx) {
+	// answers are shared, so only the first player waits for the network
+	while (!discovery_get(ctx) && ctx->running) usleep(50000);
+}
+
+/*---------------------------------------------------------------------------*/
+static void slimproto_connected(bool reconnect, struct thread_ctx_s *ctx) {
+	LOG_INFO("[%p] connected", ctx);
+
+	ctx->sendq.len = 0;
+	ctx->sendq.stmt = -1;
+
+	ctx->var_cap[0] = '\0';
+
+	// add on any capablity to be sent to the new server
+	if (ctx->new_server_cap) {
+		strcat(ctx->var_cap, ctx->new_server_cap);
+		free(ctx->new_server_cap);
+		ctx->new_server_cap = NULL;
+	}
+
+	sendHELO(reconnect, ctx->fixed_cap, ctx->var_cap, ctx->config.mac, ctx);
+
+	// playlist changes are pushed by this server
+	cli_subscribe(ctx);
+}
 
-	closesocket(disc_sock);
+/*---------------------------------------------------------------------------*/
+static void slimproto_disconnected(struct thread_ctx_s *ctx) {
+	cli_close(ctx);
+	closesocket(ctx->sock);
+	ctx->sock = -1;
+#if SLIMPROTO_REACTOR
+	ctx->slim_run.poll_fd = -1;
+#endif
 
-	ctx->slimproto_ip =  s.sin_addr.s_addr;
-	ctx->slimproto_port = ntohs(s.sin_port);
+	if (ctx->new_server_cap)	{
+		free(ctx->new_server_cap);
+		ctx->new_server_cap = NULL;
+	}
 
-	ctx->serv_addr.sin_port = s.sin_port;
-	ctx->serv_addr.sin_addr.s_addr = s.sin_addr.s_addr;
-	ctx->serv_addr.sin_family = AF_INET;
+	free(ctx->sendq.buf);
+	ctx->sendq.buf = NULL;
+	ctx->sendq.len = ctx->sendq.size = 0;
 }
 
+#if !SLIMPROTO_REACTOR
 /*---------------------------------------------------------------------------*/
 static void slimproto(struct thread_ctx_s *ctx) {
 	bool reconnect = false;
@@ -856,25 +1240,15 @@ static void slimproto(struct thread_ctx_s *ctx) {
 
 			// rediscover server if it was not set at startup
 			if (!strcmp(ctx->config.server, "?") && ++failed_connect > 5) {
+				discovery_forget(ctx->slimproto_ip);
 				ctx->slimproto_ip = 0;
 				discover_server(ctx);
             }
 
 		} else {
 
-			LOG_INFO("[%p] connected", ctx);
-
-			ctx->var_cap[0] = '\0';
 			failed_connect = 0;
-
-			// add on any capablity to be sent to the new server
-			if (ctx->new_server_cap) {
-				strcat(ctx->var_cap, ctx->new_server_cap);
-				free(ctx->new_server_cap);
-				ctx->new_server_cap = NULL;
-			}
-
-			sendHELO(reconnect, ctx->fixed_cap, ctx->var_cap, ctx->config.mac, ctx);
+			slimproto_connected(reconnect, ctx);
 
 			slimproto_run(ctx);
 
@@ -885,45 +1259,361 @@ static void slimproto(struct thread_ctx_s *ctx) {
 			usleep(100000);
 		}
 
-		mutex_lock(ctx->cli_mutex);
-		if (ctx->cli_sock != -1) {
-			closesocket(ctx->cli_sock);
-			ctx->cli_sock = -1;
+		slimproto_disconnected(ctx);
+	}
+}
+#endif
+
+#if SLIMPROTO_REACTOR
+/*---------------------------------------------------------------------------*/
+static void _slim_connect(struct thread_ctx_s *ctx, u32_t now);
+
+static void _slim_discover(struct thread_ctx_s *ctx, u32_t now) {
+	// discovery wakes us up when it has an answer
+	if (discovery_get(ctx)) {
+		_slim_connect(ctx, now);
+	} else {
+		ctx->slim_run.state = SLIM_DISCOVER;
+		ctx->slim_run.deadline = now + DISCOVERY_RETRY;
+	}
+}
+
+/*---------------------------------------------------------------------------*/
+static void _slim_connect(struct thread_ctx_s *ctx, u32_t now) {
+	LOG_INFO("[%p] connecting to %s:%d", ctx, inet_ntoa(ctx->serv_addr.sin_addr), ntohs(ctx->serv_addr.sin_port));
+
+	ctx->sock = socket(AF_INET, SOCK_STREAM, 0);
+	set_nonblock(ctx->sock);
+	set_nosigpipe(ctx->sock);
+
+	// completion (or failure) is reported as writable
+	connect(ctx->sock, (struct sockaddr *) &ctx->serv_addr, sizeof(ctx->serv_addr));
+
+	ctx->slim_run.state = SLIM_CONNECTING;
+	ctx->slim_run.deadline = now + 5000;
+}
+
+/*---------------------------------------------------------------------------*/
+static void _slim_retry(struct thread_ctx_s *ctx, u32_t delay, u32_t now) {
+	slimproto_disconnected(ctx);
+
+	ctx->slim_run.state = SLIM_RETRY;
+	ctx->slim_run.deadline = now + delay;
+}
+
+/*---------------------------------------------------------------------------*/
+// what fd and events a player waits for and until when
+static short _slim_events(struct thread_ctx_s *ctx, sockfd *fd, int *timeout, u32_t now) {
+	short wanted = POLLIN;
+	s32_t wait;
+
+	switch (ctx->slim_run.state) {
+	case SLIM_CONNECTING:
+		*fd = ctx->sock;
+		wanted = POLLOUT;
+		wait = ctx->slim_run.deadline - now;
+		break;
+	case SLIM_DISCOVER:
+	case SLIM_RETRY:
+		*fd = -1;
+		wait = ctx->slim_run.deadline - now;
+		break;
+	default:
+		*fd = ctx->sock;
+		if (ctx->sendq.len) wanted |= POLLOUT;
+		wait = ctx->slim_run.active ? (s32_t) (ctx->slim_run.last + STATUS_PERIOD - now) : 1000;
+		break;
+	}
+
+	if (wait < 0) wait = 0;
+	if (*timeout < 0 || wait < *timeout) *timeout = wait;
+
+	return wanted;
+}
+
+/*---------------------------------------------------------------------------*/
+// same sequence as slimproto() and slimproto_run(), one step at a time
+static void _slim_process(struct thread_ctx_s *ctx, short revents, bool wake, u32_t now) {
+	switch (ctx->slim_run.state) {
+	case SLIM_DISCOVER:
+		_slim_discover(ctx, now);
+		break;
+	case SLIM_CONNECTING: {
+		int error = 0;
+		socklen_t len = sizeof(error);
+
+		if (revents) getsockopt(ctx->sock, SOL_SOCKET, SO_ERROR, (void*) &error, &len);
+
+		if (revents && !error) {
+			ctx->slim_run.failed = 0;
+			ctx->slim_run.expect = ctx->slim_run.got = 0;
+			ctx->slim_run.rx = ctx->slim_run.last = now;
+			ctx->slim_run.state = SLIM_RUNNING;
+			slimproto_connected(ctx->slim_run.reconnect, ctx);
+			ctx->slim_run.reconnect = true;
+		} else if (revents || (s32_t) (now - ctx->slim_run.deadline) >= 0) {
+			LOG_WARN("[%p] unable to connect to server %u", ctx, ctx->slim_run.failed++);
+			_slim_retry(ctx, 5000, now);
+		}
+		break;
+	}
+	case SLIM_RETRY:
+		if ((s32_t) (now - ctx->slim_run.deadline) < 0) break;
+
+		if (ctx->new_server) {
+			ctx->slimproto_ip = ctx->new_server;
+			ctx->new_server = 0;
+			ctx->slim_run.reconnect = false;
+			LOG_INFO("[%p] switching server", ctx);
+			_slim_discover(ctx, now);
+		} else if (!strcmp(ctx->config.server, "?") && ctx->slim_run.failed > 5) {
+			// rediscover server if it was not set at startup
+			discovery_forget(ctx->slimproto_ip);
+			ctx->slimproto_ip = 0;
+			_slim_discover(ctx, now);
+		} else {
+			_slim_connect(ctx, now);
 		}
-		mutex_unlock(ctx->cli_mutex);
-		closesocket(ctx->sock);
+		break;
+	case SLIM_RUNNING: {
+		u32_t events = 0;
 
-		if (ctx->new_server_cap)	{
-			free(ctx->new_server_cap);
-			ctx->new_server_cap = NULL;
+		if ((revents & POLLOUT) && ctx->sendq.len) send_flush(ctx);
+
+		if (revents & (POLLIN | POLLHUP)) {
+			int n = slimproto_read(ctx);
+
+			if (n < 0) {
+				_slim_retry(ctx, 100, now);
+				break;
+			}
+
+			if (n > 0) {
+				ctx->slim_run.rx = now;
+				events = STATUS_ALL;
+			}
+		}
+
+		// expect message from server every 5 seconds, but 30 seconds on mysb.com so timeout after 35 seconds
+		if (now - ctx->slim_run.rx > 35 * 1000) {
+			LOG_WARN("[%p] No messages from server - connection dead", ctx);
+			_slim_retry(ctx, 100, now);
+			break;
+		}
+
+		if (wake) events |= atomic_xchg(&ctx->events, 0);
+
+		if (ctx->slim_run.active && (now - ctx->slim_run.last > STATUS_PERIOD || ctx->slim_run.last > now)) {
+			events = STATUS_ALL;
+		}
+
+		if (events) slimproto_status(ctx, events, now);
+
+		if (ctx->new_server) _slim_retry(ctx, 100, now);
+		break;
+	}
+	}
+}
+
+/*---------------------------------------------------------------------------*/
+static void *slimproto_reactor(void *arg) {
+	while (reactor.running) {
+		struct thread_ctx_s *ctx;
+		short revents[MAX_PLAYER];
+		bool wake[MAX_PLAYER];
+		int i, n, timeout = -1;
+		u32_t now = gettime_ms();
+#if LINUX
+		struct epoll_event events[2 * MAX_PLAYER + 1];
+#else
+		struct pollfd pollinfo[2 * MAX_PLAYER + 1];
+		struct thread_ctx_s *polled[2 * MAX_PLAYER + 1];
+		int count = 1;
+
+		pollinfo[0].fd = wake_fd(reactor.wake);
+		pollinfo[0].events = POLLIN;
+		pollinfo[0].revents = 0;
+		polled[0] = NULL;
+#endif
+
+		mutex_lock(reactor.mutex);
+
+		// collect what each player is waiting for
+		for (i = 0; i < MAX_PLAYER; i++) {
+			sockfd fd;
+			short wanted;
+
+			revents[i] = 0;
+			wake[i] = false;
+			if ((ctx = thread_ctx[i]) == NULL || !ctx->slim_run.state) continue;
+
+			wanted = _slim_events(ctx, &fd, &timeout, now);
+#if LINUX
+			// closing an fd removes it from epoll set, see slimproto_disconnected
+			if (fd >= 0 && (ctx->slim_run.poll_fd != fd || ctx->slim_run.poll_events != wanted)) {
+				struct epoll_event event = { 0 };
+
+				event.events = (wanted & POLLIN ? EPOLLIN : 0) | (wanted & POLLOUT ? EPOLLOUT : 0);
+				event.data.u32 = 2 * i + 1;
+				if (epoll_ctl(reactor.efd, ctx->slim_run.poll_fd == fd ? EPOLL_CTL_MOD : EPOLL_CTL_ADD, fd, &event) < 0) {
+					LOG_ERROR("[%p]: can't update epoll set %s", ctx, strerror(errno));
+				}
+				ctx->slim_run.poll_fd = fd;
+				ctx->slim_run.poll_events = wanted;
+			}
+#else
+			pollinfo[count].fd = wake_fd(ctx->wake_e);
+			pollinfo[count].events = POLLIN;
+			pollinfo[count].revents = 0;
+			polled[count++] = ctx;
+
+			if (fd >= 0) {
+				pollinfo[count].fd = fd;
+				pollinfo[count].events = wanted;
+				pollinfo[count].revents = 0;
+				polled[count++] = ctx;
+			}
+#endif
+		}
+
+		mutex_unlock(reactor.mutex);
+
+#if LINUX
+		n = epoll_wait(reactor.efd, events, 2 * MAX_PLAYER + 1, timeout);
+#else
+		n = poll(pollinfo, count, timeout);
+#endif
+
+		mutex_lock(reactor.mutex);
+
+#if LINUX
+		for (i = 0; i < n; i++) {
+			int k = events[i].data.u32;
+
+			// own wake-up from player (un)registration
+			if (!k) {
+				wake_clear(wake_fd(reactor.wake));
+				continue;
+			}
+
+			ctx = thread_ctx[(k - 1) / 2];
+			if (!ctx || !ctx->slim_run.state) continue;
+
+			if (k & 0x01) {
+				revents[ctx->self - 1] = (events[i].events & EPOLLIN ? POLLIN : 0) | (events[i].events & EPOLLOUT ? POLLOUT : 0) |
+											(events[i].events & (EPOLLHUP | EPOLLERR) ? POLLHUP : 0);
+			} else {
+				wake_clear(wake_fd(ctx->wake_e));
+				wake[ctx->self - 1] = true;
+			}
+		}
+#else
+		for (i = 0; n > 0 && i < count; i++) {
+			if (!pollinfo[i].revents) continue;
+
+			if (!(ctx = polled[i])) {
+				wake_clear(wake_fd(reactor.wake));
+			} else if (!ctx->slim_run.state) {
+				continue;
+			} else if (pollinfo[i].fd == wake_fd(ctx->wake_e)) {
+				wake_clear(wake_fd(ctx->wake_e));
+				wake[ctx->self - 1] = true;
+			} else {
+				revents[ctx->self - 1] = pollinfo[i].revents;
+			}
+		}
+#endif
+
+		// every player checks its own timers
+		now = gettime_ms();
+		for (i = 0; i < MAX_PLAYER; i++) {
+			if ((ctx = thread_ctx[i]) != NULL && ctx->slim_run.state) _slim_process(ctx, revents[i], wake[i], now);
 		}
+
+		mutex_unlock(reactor.mutex);
 	}
+
+	return NULL;
+}
+#endif
+
+/*---------------------------------------------------------------------------*/
+void slimproto_init(void) {
+	discovery_init();
+
+#if SLIMPROTO_REACTOR
+	pthread_attr_t attr;
+
+	mutex_create(reactor.mutex);
+	wake_create(reactor.wake);
+#if LINUX
+	struct epoll_event event = { 0 };
+
+	reactor.efd = epoll_create1(0);
+	event.events = EPOLLIN;
+	event.data.u32 = 0;
+	epoll_ctl(reactor.efd, EPOLL_CTL_ADD, wake_fd(reactor.wake), &event);
+#endif
+
+	reactor.running = true;
+	pthread_attr_init(&attr);
+	pthread_attr_setstacksize(&attr, PTHREAD_STACK_MIN + SLIMPROTO_THREAD_STACK_SIZE);
+	pthread_create(&reactor.thread, &attr, slimproto_reactor, NULL);
+	pthread_attr_destroy(&attr);
+#endif
 }
 
+/*---------------------------------------------------------------------------*/
+void slimproto_end(void) {
+#if SLIMPROTO_REACTOR
+	reactor.running = false;
+	wake_signal(reactor.wake);
+	pthread_join(reactor.thread, NULL);
+#if LINUX
+	close(reactor.efd);
+#endif
+	wake_close(reactor.wake);
+	mutex_destroy(reactor.mutex);
+#endif
+	discovery_end();
+}
 
 /*---------------------------------------------------------------------------*/
 void slimproto_close(struct thread_ctx_s *ctx) {
 	LOG_INFO("[%p] slimproto stop for %s", ctx, ctx->config.name);
+#if SLIMPROTO_REACTOR
+	mutex_lock(reactor.mutex);
+	ctx->running = false;
+	slimproto_disconnected(ctx);
+#if LINUX
+	epoll_ctl(reactor.efd, EPOLL_CTL_DEL, wake_fd(ctx->wake_e), NULL);
+#endif
+	ctx->slim_run.state = SLIM_IDLE;
+	mutex_unlock(reactor.mutex);
+#else
 	ctx->running = false;
 	wake_controller(ctx);
 	pthread_join(ctx->thread, NULL);
+#endif
 	mutex_destroy(ctx->mutex);
-	mutex_destroy(ctx->cli_mutex);
 }
 
 
 /*---------------------------------------------------------------------------*/
 void slimproto_thread_init(struct thread_ctx_s *ctx) {
+#if !SLIMPROTO_REACTOR
 	pthread_attr_t attr;
+#endif
 	char *codec, *buf;
 
 	wake_create(ctx->wake_e);
 	mutex_create(ctx->mutex);
-	mutex_create(ctx->cli_mutex);
 
 	ctx->slimproto_ip = 0;
 	ctx->slimproto_port = PORT;
-	ctx->cli_sock = ctx->sock = -1;
+	ctx->sock = -1;
+	ctx->cli_status.mode = SQ_NONE;
+	ctx->cli_status.stamp = 0;
 	ctx->running = true;
 
 	if (strcmp(ctx->config.server, "?")) {
@@ -935,7 +1625,11 @@ void slimproto_thread_init(struct thread_ctx_s *ctx) {
 	ctx->new_server_cap = NULL;
 
 	LOCK_O;
-	sprintf(ctx->fixed_cap, ",MaxSampleRate=%u", soxr_loaded ? ctx->config.sample_rate : 44100);
+#if PROCESS
+	sprintf(ctx->fixed_cap, ",MaxSampleRate=%u", ctx->decode.process ? ctx->config.sample_rate : 44100);
+#else
+	sprintf(ctx->fixed_cap, ",MaxSampleRate=%u", 44100);
+#endif
 
 	codec = buf = strdup(ctx->config.codecs);
 	while (codec && *codec ) {
@@ -944,7 +1638,8 @@ void slimproto_thread_init(struct thread_ctx_s *ctx) {
 
 		if (p) *p = '\0';
 		for (i = 0; i < MAX_CODECS; i++) {
-			if (codecs[i] && codecs[i]->id && strstr(codecs[i]->types, codec)) {
+			// codecs whose library failed to load are not advertised anymore
+			if (codecs[i] && codecs[i]->id && codec_available(codecs[i]) && strstr(codecs[i]->types, codec)) {
 				strcat(ctx->fixed_cap, ",");
 				strcat(ctx->fixed_cap, codec);
 				break;
@@ -958,10 +1653,30 @@ void slimproto_thread_init(struct thread_ctx_s *ctx) {
 
 	ctx->new_server = 0;
 
+#if SLIMPROTO_REACTOR
+	LOG_INFO("squeezelite [%p] <=> player [%p]", ctx, ctx->MR);
+
+	mutex_lock(reactor.mutex);
+	ctx->slim_run.reconnect = false;
+	ctx->slim_run.failed = 0;
+	ctx->slim_run.poll_fd = -1;
+	_slim_discover(ctx, gettime_ms());
+#if LINUX
+	struct epoll_event event = { 0 };
+
+	event.events = EPOLLIN;
+	event.data.u32 = 2 * (ctx->self - 1) + 2;
+	epoll_ctl(reactor.efd, EPOLL_CTL_ADD, wake_fd(ctx->wake_e), &event);
+#endif
+	mutex_unlock(reactor.mutex);
+
+	wake_signal(reactor.wake);
+#else
 	pthread_attr_init(&attr);
 	pthread_attr_setstacksize(&attr, PTHREAD_STACK_MIN + SLIMPROTO_THREAD_STACK_SIZE);
 	pthread_create(&ctx->thread, &attr, (void *(*)(void*)) slimproto, ctx);
 	pthread_attr_destroy(&attr);
+#endif
 }
 
 
@@ -19,7 +19,7 @@ typedef enum { SQ_NONE, SQ_PLAY, SQ_PAUSE, SQ_UNPAUSE, SQ_STOP, SQ_SEEK,
 			  SQ_VOLUME, SQ_ONOFF, SQ_NEXT, SQ_CONNECT, SQ_STARTED,
 			  SQ_METASEND, SQ_SETNAME, SQ_SETSERVER, SQ_FINISHED, SQ_PLAY_PAUSE,
 			  SQ_MUTE_TOGGLE, SQ_PREVIOUS, SQ_SHUFFLE,
-			  SQ_FF_REW, SQ_OFF } sq_action_t;
+			  SQ_FF_REW, SQ_OFF, SQ_NEWMETADATA } sq_action_t;
 
 typedef	sq_action_t sq_event_t;
 
@@ -43,6 +43,7 @@ typedef	struct sq_dev_param_s {
 	uint8_t		mac[6];
 	char 		resolution[STR_LEN];
 	bool		soft_volume;
+	unsigned	adaptive_start;		// target underrun in per-mille, 0 to use LMS thresholds
 #if defined(RESAMPLE)
 	uint32_t	sample_rate;
 	bool		resample;
@@ -59,6 +60,8 @@ typedef bool (*sq_callback_t)(void *caller, sq_action_t action, ...);
 
 void				sq_init(struct in_addr host, char *model_name);
 void				sq_end(void);
+void				sq_cache_init(char *dir, unsigned size, unsigned age);
+void				sq_cache_stats(unsigned *hits, unsigned *misses, size_t *used, int *count);
 
 bool			 	sq_run_device(sq_dev_handle_t handle, struct raopcl_s *raopcl, sq_dev_param_t *param);
 void				sq_delete_device(sq_dev_handle_t);
@@ -70,5 +73,6 @@ bool				sq_get_metadata(sq_dev_handle_t handle, metadata_t *metadata, bool next)
 uint32_t			sq_get_time(sq_dev_handle_t handle);
 bool 				sq_set_time(sq_dev_handle_t handle, char *pos);
 sq_action_t 		sq_get_mode(sq_dev_handle_t handle);
+bool				sq_subscribed(sq_dev_handle_t handle);
 void*				sq_get_ptr(sq_dev_handle_t handle);
 
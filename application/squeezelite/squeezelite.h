@@ -19,7 +19,7 @@
  *
  */
 
-// make may define: SELFPIPE, RESAMPLE, RESAMPLE_MP, LINKALL to influence build
+// make may define: SELFPIPE, RESAMPLE, RESAMPLE_MP, LINKALL, SLIMPROTO_REACTOR to influence build
 
 // build detection
 #include "platform.h"
@@ -51,6 +51,15 @@
 #define LOOPBACK  1
 #endif
 
+// one thread for all slimproto connections, make can set it to 0 for one per player
+#if !defined(SLIMPROTO_REACTOR)
+#define SLIMPROTO_REACTOR 1
+#endif
+#if WINEVENT
+#undef SLIMPROTO_REACTOR
+#define SLIMPROTO_REACTOR 0
+#endif
+
 #if !LINKALL
 
 // dynamically loaded libraries at run time
@@ -147,6 +156,13 @@ typedef int8_t   s8_t;
 
 #define MAX_HEADER 4096 // do not reduce as icy-meta max is 4080
 
+#define STREAM_RESUME_TRIES	5		// reconnections after a drop, 0 to disable
+#define STREAM_RESUME_DELAY	250		// ms, doubled at each try
+
+#define ADAPT_SAMPLES	8			// reads before arrival statistics are trusted
+#define ADAPT_MARGIN	2			// x realtime needed to start below LMS threshold
+#define ADAPT_HORIZON	30000		// ms a slower than realtime stream must last
+
 #define STREAM_THREAD_STACK_SIZE (1024 * 64)
 #define DECODE_THREAD_STACK_SIZE (1024 * 128)
 #define OUTPUT_THREAD_STACK_SIZE (1024 * 64)
@@ -176,6 +192,14 @@ typedef int sockfd;
 #define MSG_NOSIGNAL 0
 #endif
 
+#if WIN
+#define atomic_or(p, v) InterlockedOr((LONG volatile*) (p), (v))
+#define atomic_xchg(p, v) InterlockedExchange((LONG volatile*) (p), (v))
+#else
+#define atomic_or(p, v) __atomic_fetch_or((p), (v), __ATOMIC_RELEASE)
+#define atomic_xchg(p, v) __atomic_exchange_n((p), (v), __ATOMIC_ACQUIRE)
+#endif
+
 #if EVENTFD
 #include <sys/eventfd.h>
 #define event_event int
@@ -184,6 +208,7 @@ typedef int sockfd;
 #define wake_signal(e) eventfd_write(e, 1)
 #define wake_clear(e) eventfd_t val; eventfd_read(e, &val)
 #define wake_close(e) close(e)
+#define wake_fd(e) (e)
 #endif
 
 #if SELFPIPE
@@ -193,6 +218,7 @@ typedef int sockfd;
 #define wake_signal(e) write(e.fds[1], ".", 1)
 #define wake_clear(e) char c[10]; read(e, &c, 10)
 #define wake_close(e) close(e.fds[0]); close(e.fds[1])
+#define wake_fd(e) (e).fds[0]
 struct wake { 
 	int fds[2];
 };
@@ -205,6 +231,7 @@ struct wake {
 #define wake_signal(e) send(e.fds[1], ".", 1, 0)
 #define wake_clear(e) char c; recv(e, &c, 1, 0)
 #define wake_close(e) closesocket(e.mfds); closesocket(e.fds[0]); closesocket(e.fds[1])
+#define wake_fd(e) (e).fds[0]
 struct wake {
 	int mfds;
 	int fds[2];
@@ -228,7 +255,7 @@ void _wake_create(event_event*);
 #define BYTES_PER_FRAME 4
 
 // utils.c (non logging)
-typedef enum { EVENT_TIMEOUT = 0, EVENT_READ, EVENT_WAKE } event_type;
+typedef enum { EVENT_TIMEOUT = 0, EVENT_READ, EVENT_WAKE, EVENT_WRITE } event_type;
 struct thread_ctx_s;
 
 char *next_param(char *src, char c);
@@ -291,16 +318,28 @@ void buf_init(struct buffer *buf, size_t size);
 void buf_destroy(struct buffer *buf);
 
 // slimproto.c
+void slimproto_init(void);
+void slimproto_end(void);
 void slimproto_close(struct thread_ctx_s *ctx);
 void slimproto_reset(struct thread_ctx_s *ctx);
 void slimproto_thread_init(struct thread_ctx_s *ctx);
-void wake_controller(struct thread_ctx_s *ctx);
 void send_packet(u8_t *packet, size_t len, sockfd sock);
 void wake_controller(struct thread_ctx_s *ctx);
+void post_status(struct thread_ctx_s *ctx, u32_t events);
+
+// status changes published to slimproto, each maps to what the controller re-reads
+#define STATUS_STREAM	0x01	// stream state, headers or metadata (LOCK_S)
+#define STATUS_OUTPUT	0x02	// output started or drained (LOCK_O)
+#define STATUS_TRACK	0x04	// track started and its start time known (LOCK_O)
+#define STATUS_DECODE	0x08	// decode completed or failed (LOCK_D)
+#define STATUS_ALL		0xff
+#define STATUS_PERIOD	500		// ms, sweep of active players (STMt)
+#define SENDQ_MAX		(64*1024)	// bytes, slimproto frames waiting to be sent
 
 // stream.c
 typedef enum { STOPPED = 0, DISCONNECT, STREAMING_WAIT,
-			   STREAMING_BUFFERING, STREAMING_FILE, STREAMING_HTTP, SEND_HEADERS, RECV_HEADERS } stream_state;
+			   STREAMING_BUFFERING, STREAMING_FILE, STREAMING_HTTP, SEND_HEADERS, RECV_HEADERS,
+			   CONNECTING, TLS_HANDSHAKE, RESUME_WAIT } stream_state;
 typedef enum { DISCONNECT_OK = 0, LOCAL_DISCONNECT = 1, REMOTE_DISCONNECT = 2, UNREACHABLE = 3, TIMEOUT = 4 } disconnect_code;
 
 struct streamstate {
@@ -319,12 +358,46 @@ struct streamstate {
 	u32_t meta_left;
 	bool  meta_send;
 	size_t header_mlen;
+	size_t header_sent;			// bytes of request already written
+	int poll_fd;				// fd & events registered to stream reactor
+	short poll_events;
+	bool use_ssl, ssl_fallback;	// connection setup
+	short ssl_events;
+	u32_t deadline;
+	struct {					// file mapped in place of streambuf
+		u8_t *buf;
+		size_t size, len;
+	} map;
+	char *request;				// original request, replayed with a range on resume
+	size_t request_len;
+	struct {
+		bool allowed;
+		int tries;
+		stream_state state;
+		u64_t offset, length;
+	} resume;
+	struct {					// arrival statistics, for adaptive start
+		u32_t start, last;		// ms, first and last read (0 to skip next gap)
+		u32_t samples;
+		u32_t gap, jitter;		// ms, smoothed inter-arrival and its mean deviation
+		u32_t prebuffer;		// ms, stall to survive with target underrun probability
+		float z;
+	} adapt;
+	struct {					// disk cache, hits are mapped and misses recorded
+		u64_t key;
+		bool hit;
+		struct cache_rec *rec;	// response being recorded
+	} cache;
 	struct sockaddr_in addr;
 	char host[256];
 	struct {
 		bool flac;
 		u64_t serial;
 		bool active;
+		u8_t hdr[27 + 255];		// raw page header being assembled
+		size_t hlen, left;		// its length and page body still to come
+		bool feed;				// page goes to sync layer, otherwise skipped
+		u64_t last;				// serial of previous page
 		ogg_stream_state state;
 		ogg_packet packet;
 		ogg_sync_state sync;
@@ -340,6 +413,36 @@ void stream_file(const char *header, size_t header_len, unsigned threshold, stru
 void stream_sock(u32_t ip, u16_t port, bool use_ssl, bool use_ogg, const char *header, size_t header_len, unsigned threshold, bool cont_wait, struct thread_ctx_s *ctx);
 bool stream_disconnect(struct thread_ctx_s *ctx);
 
+// cache.c
+void  cache_init(const char *dir, unsigned size, unsigned age);
+void  cache_end(void);
+u64_t cache_key(const char *header);
+int   cache_open(u64_t key, char *header, size_t *header_len);
+void  cache_miss(void);
+struct cache_rec *cache_create(u64_t key, size_t size, const char *header, size_t header_len);
+void  cache_write(struct cache_rec *rec, const void *data, size_t len);
+void  cache_abort(struct cache_rec *rec);
+void  cache_commit(struct cache_rec *rec, size_t size);
+void  cache_stats(unsigned *hits, unsigned *misses, size_t *used, int *count);
+
+// cli.c
+typedef void (*cli_cb_t)(struct thread_ctx_s *ctx, char *rsp, void *arg);
+void  cli_init(void);
+void  cli_end(void);
+void  cli_close(struct thread_ctx_s *ctx);
+void  cli_subscribe(struct thread_ctx_s *ctx);
+bool  cli_subscribed(struct thread_ctx_s *ctx);
+bool  cli_send_async(char *cmd, bool req, bool decode, cli_cb_t callback, void *arg, struct thread_ctx_s *ctx);
+char *cli_send_cmd(char *cmd, bool req, bool decode, struct thread_ctx_s *ctx);
+#define CLI_MAX_TAGS	128
+typedef struct {			// spans in a response, still encoded
+	char 	*tag, *value;
+	size_t	tag_len, len;
+} cli_tag_t;
+int   cli_parse(char *rsp, cli_tag_t *tags, int max);
+bool  cli_tag_is(cli_tag_t *tag, char *name);
+char *cli_tag_value(cli_tag_t *tag, char **arena);
+
 // decode.c
 typedef enum { DECODE_STOPPED = 0, DECODE_READY, DECODE_RUNNING, DECODE_COMPLETE, DECODE_ERROR } decode_state;
 
@@ -365,6 +468,8 @@ struct processstate {
 };
 #endif
 
+#define CODEC_POOL_SIZE 4
+
 struct codec {
 	char id;
 	char *types;
@@ -373,6 +478,13 @@ struct codec {
 	void (*open)(u8_t sample_size, u32_t sample_rate, u8_t channels, u8_t endianness, struct thread_ctx_s *ctx);
 	void (*close)(struct thread_ctx_s *ctx);
 	decode_state (*decode)(struct thread_ctx_s *ctx);
+	bool (*load)(void);				// optional, library is loaded at first open
+	void (*release)(void *handle);	// optional, frees a pooled decoder handle
+	int loaded;						// 0: not yet, 1: ok, -1: failed
+	struct {
+		void *items[CODEC_POOL_SIZE];
+		int count;
+	} pool;
 };
 
 void decode_init(void);
@@ -383,6 +495,11 @@ void decode_close(struct thread_ctx_s *ctx);
 void decode_flush(struct thread_ctx_s *ctx);
 unsigned decode_newstream(unsigned sample_rate, int supported_rates[], struct thread_ctx_s *ctx);
 bool codec_open(u8_t codec, u8_t sample_size, u32_t sample_rate, u8_t channels, u8_t endianness, struct thread_ctx_s *ctx);
+void *codec_pool_get(struct codec *codec);
+bool codec_pool_put(struct codec *codec, void *handle);
+bool codec_pool_full(struct codec *codec);
+bool codec_available(struct codec *codec);
+bool library_load(bool *loaded, bool (*load)(void));
 
 #if PROCESS
 // process.c
@@ -437,6 +554,7 @@ struct outputstate {
 	};
 	u8_t  *track_start;        // set in decode thread
 	bool  detect_start_time;   // use in audio extractor
+	bool  drained;             // outputbuf empty has been posted
 	u32_t gainL;               // set by slimproto
 	u32_t gainR;               // set by slimproto
 	u32_t next_replay_gain;    // set by slimproto
@@ -451,6 +569,11 @@ struct outputstate {
 	int buf_frames;
 	u8_t *buf;
 	u8_t channels;
+	struct {					// copy of stream's arrival statistics, set under outputbuf lock
+		bool streaming;
+		u32_t start, samples;
+		u32_t gap, jitter, prebuffer;
+	} adapt;
 };
 
 void output_init(const char *device, unsigned output_buf_size, unsigned rates[], struct thread_ctx_s *ctx);
@@ -500,7 +623,7 @@ typedef struct {
 typedef enum {TRACK_STOPPED = 0, TRACK_STARTED, TRACK_PAUSED} track_status_t;
 
 #define SERVER_VERSION_LEN	32
-#define MAX_PLAYER		32
+#define MAX_PLAYER		256		// slots, contexts are allocated on first use
 
 struct thread_ctx_s {
 	int 	self;
@@ -534,20 +657,23 @@ struct thread_ctx_s {
 	char		server_port[5+1];
 	char		server_ip[4*(3+1)+1];
 	u16_t		cli_port;
-	sockfd 		sock, fd, cli_sock;
+	sockfd 		sock, fd;
 #if USE_SSL
 	void		*ssl;
 	bool		ssl_error;
 #endif
 	char		cli_id[18];		// (6*2)+(5*':')+NULL
-	mutex_type	cli_mutex;
-	u32_t		cli_timeout;
+	struct cli_conn	*cli;		// shared with server's other players, owned by cli.c
+	bool		cli_subscriber;	// wants playlist notifications
+	struct {				// last known from LMS, refreshed asynchronously
+		sq_action_t	mode;
+		u32_t		time, stamp;
+	} cli_status;
 	int bytes_per_frame;		// for output
 	bool	output_running;		// for output.c
 	bool	stream_running;		// for stream.c
 	bool	decode_running;		// for decode.c
 	thread_type output_thread;	// output.c child thread
-	thread_type stream_thread;	// stream.c child thread
 	thread_type decode_thread;	// decode.c child thread
 	thread_type	thread;			// main instance thread
 	struct sockaddr_in serv_addr;
@@ -557,13 +683,29 @@ struct thread_ctx_s {
 		 u8_t 	buffer[MAXBUF];
 		 u32_t	last;
 		 char	header[MAX_HEADER];
+		 bool	active;			// something is playing, sweep periodically
+		 int	expect, got;	// frame being assembled
+#if SLIMPROTO_REACTOR
+		 int	state;
+		 u32_t	deadline, rx;
+		 sockfd	poll_fd;
+		 short	poll_events;
+		 bool	reconnect;
+		 unsigned failed;
+#endif
 	} slim_run;
+	volatile u32_t	events;		// STATUS_xxx posted by stream, decode and output
+	struct {				// slimproto frames waiting for socket to be writable
+		u8_t	*buf;
+		size_t	len, size;
+		int		stmt;		// offset of a pending STMt, -1 if none
+	} sendq;
 	sq_callback_t	callback;
 	void			*MR;
 	u8_t *silencebuf;
 };
 
-extern struct thread_ctx_s 	thread_ctx[MAX_PLAYER];
+extern struct thread_ctx_s 	*thread_ctx[MAX_PLAYER];
 extern char					sq_model_name[];
 extern struct in_addr		sq_local_host;
 extern u16_t 				sq_local_port;
@@ -24,6 +24,17 @@
 #include "squeezelite.h"
 
 #include <fcntl.h>
+#include <math.h>
+#if !WIN
+#include <sys/uio.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+#if LINUX
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#endif
 
 #if USE_SSL
 #include "openssl/ssl.h"
@@ -62,10 +73,174 @@ static log_level 	*loglevel = &stream_loglevel;
 
 #define PTR_U32(p)	((u32_t) (*(u32_t*)p))
 
+// one thread serves all players' stream sockets
+static struct {
+	thread_type thread;
+	mutex_type mutex;
+	bool running;
+#if LINUX
+	int efd, wake;
+#endif
+} reactor;
+
+static void reactor_wake(void);
+
 #if USE_SSL
 
+#define SSL_CACHE_SIZE	16
+
 static SSL_CTX *SSLctx = NULL;
 static int SSLcount = 0;
+static int SSLkey = -1;		// ex_data index of the server key a connection is for
+
+// client sessions kept for resumption, per server (host:port)
+static struct {
+	mutex_type mutex;
+	struct {
+		char key[256 + 7];
+		SSL_SESSION *session;
+		u32_t last;
+	} items[SSL_CACHE_SIZE], hosts[SSL_CACHE_SIZE];	// sessions, servers that need SSL
+} SSLcache;
+
+static void _ssl_cache_key(char *key, struct thread_ctx_s *ctx) {
+	// SNI name is what the server's session is bound to, not the address
+	sprintf(key, "%s:%hu", *ctx->stream.host ? ctx->stream.host : inet_ntoa(ctx->stream.addr.sin_addr),
+			ntohs(ctx->stream.addr.sin_port));
+}
+
+// returns a referenced session or NULL
+static SSL_SESSION *ssl_cache_get(struct thread_ctx_s *ctx) {
+	SSL_SESSION *session = NULL;
+	char key[sizeof(SSLcache.items[0].key)];
+	int i;
+
+	_ssl_cache_key(key, ctx);
+	mutex_lock(SSLcache.mutex);
+
+	for (i = 0; i < SSL_CACHE_SIZE; i++) {
+		if (!SSLcache.items[i].session || strcmp(SSLcache.items[i].key, key)) continue;
+		session = SSLcache.items[i].session;
+		SSL_SESSION_up_ref(session);
+		SSLcache.items[i].last = gettime_ms();
+		break;
+	}
+
+	mutex_unlock(SSLcache.mutex);
+	return session;
+}
+
+static void ssl_cache_del(struct thread_ctx_s *ctx) {
+	char key[sizeof(SSLcache.items[0].key)];
+	int i;
+
+	_ssl_cache_key(key, ctx);
+	mutex_lock(SSLcache.mutex);
+
+	for (i = 0; i < SSL_CACHE_SIZE; i++) {
+		if (!SSLcache.items[i].session || strcmp(SSLcache.items[i].key, key)) continue;
+		SSL_SESSION_free(SSLcache.items[i].session);
+		SSLcache.items[i].session = NULL;
+	}
+
+	mutex_unlock(SSLcache.mutex);
+}
+
+static bool ssl_host_needed(struct thread_ctx_s *ctx) {
+	char key[sizeof(SSLcache.hosts[0].key)];
+	bool found = false;
+	int i;
+
+	_ssl_cache_key(key, ctx);
+	mutex_lock(SSLcache.mutex);
+
+	for (i = 0; i < SSL_CACHE_SIZE && !found; i++) {
+		if (SSLcache.hosts[i].last && !strcmp(SSLcache.hosts[i].key, key)) {
+			SSLcache.hosts[i].last = gettime_ms();
+			found = true;
+		}
+	}
+
+	mutex_unlock(SSLcache.mutex);
+	return found;
+}
+
+static void ssl_host_add(struct thread_ctx_s *ctx) {
+	char key[sizeof(SSLcache.hosts[0].key)];
+	int i, slot = 0;
+
+	_ssl_cache_key(key, ctx);
+	mutex_lock(SSLcache.mutex);
+
+	// might already be there, otherwise evict least recently used
+	for (i = 0; i < SSL_CACHE_SIZE; i++) {
+		if (SSLcache.hosts[i].last && !strcmp(SSLcache.hosts[i].key, key)) {
+			slot = i;
+			break;
+		}
+		if (SSLcache.hosts[i].last < SSLcache.hosts[slot].last) slot = i;
+	}
+
+	strcpy(SSLcache.hosts[slot].key, key);
+	SSLcache.hosts[slot].last = gettime_ms();
+
+	mutex_unlock(SSLcache.mutex);
+}
+
+static void ssl_cache_flush(void) {
+	int i;
+
+	mutex_lock(SSLcache.mutex);
+
+	for (i = 0; i < SSL_CACHE_SIZE; i++) {
+		if (SSLcache.items[i].session) SSL_SESSION_free(SSLcache.items[i].session);
+		SSLcache.items[i].session = NULL;
+		SSLcache.hosts[i].last = 0;
+	}
+
+	mutex_unlock(SSLcache.mutex);
+}
+
+static void ssl_key_free(void *parent, void *ptr, CRYPTO_EX_DATA *ad, int idx, long argl, void *argp) {
+	free(ptr);
+}
+
+/*
+called by OpenSSL when a new session (or TLS 1.3 ticket, that might come
+after the handshake) is available, we keep the latest per server
+*/
+static int ssl_new_session(SSL *ssl, SSL_SESSION *session) {
+	struct thread_ctx_s *ctx = SSL_get_app_data(ssl);
+	char *key = SSL_get_ex_data(ssl, SSLkey);
+	int i, slot = 0;
+
+	// stream might have moved to another server since that connection was opened
+	if (!ctx || !key || !SSL_SESSION_is_resumable(session)) return 0;
+
+	mutex_lock(SSLcache.mutex);
+
+	// replace same server, otherwise use a free or the least recently used slot
+	for (i = 0; i < SSL_CACHE_SIZE; i++) {
+		if (SSLcache.items[i].session && !strcmp(SSLcache.items[i].key, key)) {
+			slot = i;
+			break;
+		}
+		if (!SSLcache.items[i].session) slot = i;
+		else if (SSLcache.items[slot].session && SSLcache.items[i].last < SSLcache.items[slot].last) slot = i;
+	}
+
+	if (SSLcache.items[slot].session) SSL_SESSION_free(SSLcache.items[slot].session);
+	strcpy(SSLcache.items[slot].key, key);
+	SSLcache.items[slot].session = session;
+	SSLcache.items[slot].last = gettime_ms();
+
+	mutex_unlock(SSLcache.mutex);
+
+	LOG_DEBUG("[%p]: new SSL session for %s", ctx, key);
+
+	// we own the session reference now
+	return 1;
+}
 
 static int _last_error(struct thread_ctx_s* ctx) {
 	if (!ctx->ssl) return last_error();
@@ -74,7 +249,7 @@ static int _last_error(struct thread_ctx_s* ctx) {
 
 static int _recv(struct thread_ctx_s *ctx, void *buffer, size_t bytes, int options) {
 	if (!ctx->ssl) return recv(ctx->fd, buffer, bytes, options);
-	int n = SSL_read(ctx->ssl, (u8_t*) buffer, bytes);
+	int n = (options & MSG_PEEK) ? SSL_peek(ctx->ssl, (u8_t*) buffer, bytes) : SSL_read(ctx->ssl, (u8_t*) buffer, bytes);
 	if (n <= 0) {
 		int err = SSL_get_error(ctx->ssl, n);
 		if (err == SSL_ERROR_ZERO_RETURN) return 0;
@@ -85,68 +260,55 @@ static int _recv(struct thread_ctx_s *ctx, void *buffer, size_t bytes, int optio
 
 static int _send(struct thread_ctx_s *ctx, void *buffer, size_t bytes, int options) {
 	if (!ctx->ssl) return send(ctx->fd, buffer, bytes, options);
-	int n = 0;
-	do {
-		ERR_clear_error();
-		if ((n = SSL_write(ctx->ssl, (u8_t*) buffer, bytes)) >= 0) break;
+	ERR_clear_error();
+	int n = SSL_write(ctx->ssl, (u8_t*) buffer, bytes);
+	if (n <= 0) {
 		int err = SSL_get_error(ctx->ssl, n);
 		ctx->ssl_error = (err != SSL_ERROR_WANT_READ && err != SSL_ERROR_WANT_WRITE);
-	} while (!ctx->ssl_error);
+		// must be called again with same arguments once socket is ready
+		ctx->stream.ssl_events = err == SSL_ERROR_WANT_READ ? POLLIN : POLLOUT;
+		n = -1;
+	}
 	return n;
 }
 
-/*
-can't mimic exactly poll as SSL is a real pain. Even if SSL_pending returns
-0, there might be bytes to read but when select (poll) return > 0, there might
-be no frame available. As well select (poll) < 0 does not mean that there is
-no data pending
-*/
-static int _poll(struct thread_ctx_s *ctx, struct pollfd *pollinfo, int timeout) {
-	if (!ctx->ssl) return poll(pollinfo, 1, timeout);
-	if (pollinfo->events & POLLIN && SSL_pending(ctx->ssl)) {
-		if (pollinfo->events & POLLOUT) poll(pollinfo, 1, 0);
-		pollinfo->revents = POLLIN;
-		return 1;
-	}
-	return poll(pollinfo, 1, timeout);
-}
 #else
 #define _recv(ctx, buf, n, opt) recv(ctx->fd, buf, n, opt)
 #define _send(ctx, buf, n, opt) send(ctx->fd, buf, n, opt)
-#define _poll(ctx, pollinfo, timeout) poll(pollinfo, 1, timeout)
 #define _last_error(x) last_error()
 #endif
 
+// called with LOCK_S when socket is ready, returns true once the whole header is sent
 static bool send_header(struct thread_ctx_s *ctx) {
-	char *ptr = ctx->stream.header;
-	int len = ctx->stream.header_len;
-
-	unsigned try = 0;
-	ssize_t n;
-
-	while (len) {
-		n = _send(ctx, ptr, len, MSG_NOSIGNAL);
+	while (ctx->stream.header_sent < ctx->stream.header_len) {
+		ssize_t n = _send(ctx, ctx->stream.header + ctx->stream.header_sent,
+						  ctx->stream.header_len - ctx->stream.header_sent, MSG_NOSIGNAL);
 		if (n <= 0) {
-			if (n < 0 && _last_error(ctx) == ERROR_WOULDBLOCK && try < 10) {
-				LOG_SDEBUG("[%p]: retrying (%d) writing to socket", ctx, ++try);
-				usleep(1000);
-				continue;
-			}
+			// reactor will call us again when socket is ready
+			if (n < 0 && _last_error(ctx) == ERROR_WOULDBLOCK) return false;
 			LOG_WARN("[%p]: failed writing to socket: %s", ctx, strerror(_last_error(ctx)));
 			ctx->stream.disconnect = LOCAL_DISCONNECT;
 			ctx->stream.state = DISCONNECT;
-			wake_controller(ctx);
+			post_status(ctx, STATUS_STREAM);
 			return false;
 		}
-		LOG_SDEBUG("[%p]: wrote %d bytes to socket", ctx, n);
-		ptr += n;
-		len -= n;
+		LOG_SDEBUG("[%p]: wrote %zd bytes to socket", ctx, n);
+		ctx->stream.header_sent += n;
 	}
 	LOG_SDEBUG("[%p]: wrote header", ctx);
 	return true;
 }
 
+/*---------------------------------------------------------------------------*/
+static void _stream_uncache(struct thread_ctx_s *ctx) {
+	// incomplete recording is of no use
+	cache_abort(ctx->stream.cache.rec);
+	ctx->stream.cache.rec = NULL;
+}
+
+static void _stream_adapt_publish(struct thread_ctx_s *ctx);
 
+/*---------------------------------------------------------------------------*/
 static void _disconnect(stream_state state, disconnect_code disconnect, struct thread_ctx_s *ctx) {
 	ctx->stream.state = state;
 	ctx->stream.disconnect = disconnect;
@@ -158,22 +320,54 @@ static void _disconnect(stream_state state, disconnect_code disconnect, struct t
 	}
 #endif
 	closesocket(ctx->fd);
-	ctx->fd = -1;
+	ctx->fd = ctx->stream.poll_fd = -1;
 	if (ctx->stream.ogg.active) {
 		OG(&go, stream_clear, &ctx->stream.ogg.state);
 		OG(&go, sync_clear, &ctx->stream.ogg.sync);
 	}
-	wake_controller(ctx);
+	_stream_uncache(ctx);
+	_stream_adapt_publish(ctx);
+	post_status(ctx, STATUS_STREAM);
+}
+
+static void _connect(bool use_ssl, struct thread_ctx_s *ctx);
+static bool _stream_resume(struct thread_ctx_s *ctx);
+
+// close what has been opened and try without SSL if it was only a guess
+static void _connect_failed(struct thread_ctx_s *ctx) {
+#if USE_SSL
+	if (ctx->ssl) {
+		// handshake did not complete, might be because of session
+		ssl_cache_del(ctx);
+		SSL_free(ctx->ssl);
+		ctx->ssl = NULL;
+	}
+#endif
+	if (ctx->fd >= 0) closesocket(ctx->fd);
+	ctx->fd = ctx->stream.poll_fd = -1;
+
+	// failed while resuming, try again later
+	if (ctx->stream.resume.tries && _stream_resume(ctx)) return;
+
+	if (ctx->stream.use_ssl && ctx->stream.ssl_fallback) {
+		LOG_INFO("[%p]: trying plain connection", ctx);
+		ctx->stream.ssl_fallback = false;
+		_connect(false, ctx);
+	} else {
+		_disconnect(DISCONNECT, UNREACHABLE, ctx);
+	}
 }
 
-static int connect_socket(bool use_ssl, struct thread_ctx_s *ctx) {
+// called with LOCK_S, reactor carries on with CONNECTING and TLS_HANDSHAKE states
+static void _connect(bool use_ssl, struct thread_ctx_s *ctx) {
 	int sock = socket(AF_INET, SOCK_STREAM, 0);
 
 	LOG_INFO("[%p]: connecting to %s:%d", ctx, inet_ntoa(ctx->stream.addr.sin_addr), ntohs(ctx->stream.addr.sin_port));
 
 	if (sock < 0) {
 		LOG_ERROR("[%p]: failed to create socket", ctx);
-		return sock;
+		_disconnect(DISCONNECT, UNREACHABLE, ctx);
+		return;
 	}
 
 	/* This is to force at least Windows to not have gigantic TCP buffer that cause a
@@ -188,49 +382,105 @@ static int connect_socket(bool use_ssl, struct thread_ctx_s *ctx) {
 	set_nonblock(sock);
 	set_nosigpipe(sock);
 
-	if (tcp_connect_timeout(sock, ctx->stream.addr, 10*1000) < 0) {
+	ctx->fd = sock;
+	ctx->stream.poll_fd = -1;
+	ctx->stream.use_ssl = use_ssl;
+	ctx->stream.ssl_events = POLLOUT;
+	ctx->stream.header_sent = 0;
+	ctx->stream.deadline = gettime_ms() + 10*1000;
+	ctx->stream.state = CONNECTING;
+
+	if (connect(sock, (struct sockaddr*) &ctx->stream.addr, sizeof(ctx->stream.addr)) < 0 &&
+		last_error() != ERROR_WOULDBLOCK && last_error() != EINPROGRESS) {
 		LOG_WARN("[%p]: unable to connect to server", ctx);
-		closesocket(sock);
-		return -1;
+		_connect_failed(ctx);
+	}
+}
+
+#if USE_SSL
+static void _handshake(struct thread_ctx_s *ctx) {
+	int status, err;
+
+	ERR_clear_error();
+	status = SSL_connect(ctx->ssl);
+
+	// successful negotiation
+	if (status == 1) {
+		LOG_INFO("[%p]: streaming with SSL (%s)", ctx, SSL_session_reused(ctx->ssl) ? "resumed" : "new session");
+		ctx->stream.ssl_events = POLLOUT;
+		ctx->stream.state = SEND_HEADERS;
+		return;
+	}
+
+	// non-blocking requires more time, wait for what SSL needs
+	err = SSL_get_error(ctx->ssl, status);
+	if (err == SSL_ERROR_WANT_READ || err == SSL_ERROR_WANT_WRITE) {
+		ctx->stream.ssl_events = err == SSL_ERROR_WANT_READ ? POLLIN : POLLOUT;
+		return;
+	}
+
+	LOG_WARN("[%p]: unable to open SSL socket %d (%d)", ctx, status, err);
+	_connect_failed(ctx);
+}
+#endif
+
+// called with LOCK_S when reactor has an event (or deadline) for connection setup
+static void _connect_process(struct thread_ctx_s *ctx, short revents) {
+	if ((int) (gettime_ms() - ctx->stream.deadline) > 0) {
+		LOG_WARN("[%p]: unable to connect to server (timeout)", ctx);
+		_connect_failed(ctx);
+		return;
 	}
 
 #if USE_SSL
-	if (use_ssl) {
-		ctx->ssl = SSL_new(SSLctx);
-		SSL_set_fd(ctx->ssl, sock);
+	if (ctx->stream.state == TLS_HANDSHAKE) {
+		if (revents) _handshake(ctx);
+		return;
+	}
+#endif
 
-		// add SNI
-		if (*ctx->stream.host) SSL_set_tlsext_host_name(ctx->ssl, ctx->stream.host);
+	if (revents & (POLLOUT | POLLHUP)) {
+		int err = 0;
+		socklen_t len = sizeof(err);
+
+		getsockopt(ctx->fd, SOL_SOCKET, SO_ERROR, (void*) &err, &len);
+		if (err) {
+			LOG_WARN("[%p]: unable to connect to server: %s", ctx, strerror(err));
+			_connect_failed(ctx);
+			return;
+		}
 
-		// try to connect (socket is non-blocking)
-		while (1) {
-			int status, err = 0;
+#if USE_SSL
+		if (ctx->stream.use_ssl) {
+			SSL_SESSION *session;
 
-			ERR_clear_error();
-			status = SSL_connect(ctx->ssl);
+			char *key = malloc(sizeof(SSLcache.items[0].key));
 
-			// successful negotiation
-			if (status == 1) break;
+			ctx->ssl = SSL_new(SSLctx);
+			SSL_set_fd(ctx->ssl, ctx->fd);
+			SSL_set_app_data(ctx->ssl, ctx);
 
-			// error or non-blocking requires more time
-			if (status < 0) {
-				err = SSL_get_error(ctx->ssl, status);
-				if (err == SSL_ERROR_WANT_READ || err == SSL_ERROR_WANT_WRITE) continue;
-			}
+			// late session tickets must be stored for that server, whatever comes next
+			_ssl_cache_key(key, ctx);
+			SSL_set_ex_data(ctx->ssl, SSLkey, key);
 
-			LOG_WARN("[%p]: unable to open SSL socket %d (%d)", ctx, status, err);
+			// add SNI
+			if (*ctx->stream.host) SSL_set_tlsext_host_name(ctx->ssl, ctx->stream.host);
 
-			closesocket(sock);
-			SSL_free(ctx->ssl);
-			ctx->ssl = NULL;
+			// try to resume a previous session with that server
+			if ((session = ssl_cache_get(ctx)) != NULL) {
+				SSL_set_session(ctx->ssl, session);
+				SSL_SESSION_free(session);
+			}
 
-			return -1;
+			ctx->stream.state = TLS_HANDSHAKE;
+			_handshake(ctx);
+			return;
 		}
-		LOG_INFO("[%p]: streaming with SSL", ctx);
-	} else ctx->ssl = NULL;
 #endif
 
-	return sock;
+		ctx->stream.state = SEND_HEADERS;
+	}
 }
 
 static u32_t inline itohl(u32_t littlelong) {
@@ -245,14 +495,7 @@ static u32_t inline itohl(u32_t littlelong) {
  * https://xiph.org/flac/ogg_mapping.html
  * https://xiph.org/vorbis/doc/Vorbis_I_spec.html#x1-610004.2 */
 
-static void stream_ogg(struct thread_ctx_s* ctx, size_t n) {
-	if (!ctx->stream.ogg.active) return;
-
-	// fill sync buffer with all what we have
-	char* buffer = OG(&go, sync_buffer, &ctx->stream.ogg.sync, n);
-	memcpy(buffer, ctx->streambuf->writep, n);
-	OG(&go, sync_wrote, &ctx->stream.ogg.sync, n);
-
+static void _ogg_pageout(struct thread_ctx_s* ctx) {
 	// extract a page from sync buffer
 	while (OG(&go, sync_pageout, &ctx->stream.ogg.sync, &ctx->stream.ogg.page) > 0) {
 		uint32_t serial = OG(&go, page_serialno, &ctx->stream.ogg.page);
@@ -313,7 +556,7 @@ static void stream_ogg(struct thread_ctx_s* ctx, size_t n) {
 			ctx->stream.ogg.flac = false;
 			ctx->stream.ogg.serial = ULLONG_MAX;
 			ctx->stream.meta_send = true;
-			wake_controller(ctx);
+			post_status(ctx, STATUS_STREAM);
 			LOG_INFO("[%p]: metadata length: %u", ctx, ctx->stream.header_len - 3);
 
 			// return as we might have more than one metadata set but we want the first one
@@ -322,254 +565,770 @@ static void stream_ogg(struct thread_ctx_s* ctx, size_t n) {
 	}
 }
 
-static void *stream_thread(struct thread_ctx_s *ctx) {
-	while (ctx->stream_running) {
+/*---------------------------------------------------------------------------*/
+static void _ogg_feed(struct thread_ctx_s* ctx, u8_t *p, size_t n) {
+	char* buffer = OG(&go, sync_buffer, &ctx->stream.ogg.sync, n);
+	memcpy(buffer, p, n);
+	OG(&go, sync_wrote, &ctx->stream.ogg.sync, n);
+}
 
-		struct pollfd pollinfo;
-		size_t space;
+/*---------------------------------------------------------------------------*/
+static void _ogg_header(struct thread_ctx_s* ctx) {
+	u8_t *h = ctx->stream.ogg.hdr;
+	u32_t serial = h[14] | h[15] << 8 | h[16] << 16 | (u32_t) h[17] << 24;
+	u64_t granule = 0;
+	size_t len = 0;
+	int i;
+
+	for (i = 7; i >= 0; i--) granule = (granule << 8) | h[6 + i];
+	for (i = 0; i < h[26]; i++) len += h[27 + i];
+
+	// headers are on BOS and following pages of our serial, until audio (granule) starts
+	ctx->stream.ogg.feed = (h[5] & 0x02) || serial != ctx->stream.ogg.last ||
+						   (serial == ctx->stream.ogg.serial && (!granule || granule == (u64_t) -1));
+
+	// audio page of the stream we were waiting headers from, we overshot
+	if (!ctx->stream.ogg.feed && serial == ctx->stream.ogg.serial) ctx->stream.ogg.serial = ULLONG_MAX;
+
+	ctx->stream.ogg.last = serial;
+	ctx->stream.ogg.left = len;
+	ctx->stream.ogg.hlen = 0;
+
+	if (ctx->stream.ogg.feed) {
+		_ogg_feed(ctx, h, 27 + h[26]);
+		if (!len) _ogg_pageout(ctx);
+	}
+}
 
-		LOCK_S;
+/*---------------------------------------------------------------------------*/
+static void stream_ogg(struct thread_ctx_s* ctx, size_t n) {
+	u8_t *p = ctx->streambuf->writep;
 
-		/*
-		It is required to use min with buf_space as it is the full space - 1,
-		otherwise, a write to full would be authorized and the write pointer
-		would wrap to the read pointer, making impossible to know if the buffer
-		is full or empty. This has the consequence, though, that the buffer can
-		never be totally full and can only wrap once the read pointer has moved
-		so it is impossible to count on having a proper multiply of any number
-		of bytes in the buffer
-		*/
-		space = min(_buf_space(ctx->streambuf), _buf_cont_write(ctx->streambuf));
+	if (!ctx->stream.ogg.active) return;
 
-		if (ctx->fd < 0 || !space || ctx->stream.state <= STREAMING_WAIT) {
-			UNLOCK_S;
-			usleep(100 * 1000);
+	// walk pages and only give sync layer the ones that might carry metadata
+	while (n) {
+		size_t bytes;
+
+		// page body, skipped or fed
+		if (ctx->stream.ogg.left) {
+			bytes = min(n, ctx->stream.ogg.left);
+			if (ctx->stream.ogg.feed) _ogg_feed(ctx, p, bytes);
+			ctx->stream.ogg.left -= bytes;
+			if (!ctx->stream.ogg.left && ctx->stream.ogg.feed) _ogg_pageout(ctx);
+			p += bytes;
+			n -= bytes;
 			continue;
 		}
 
-		if (ctx->stream.state == STREAMING_FILE) {
+		// capture pattern, byte per byte as we might be out of sync
+		if (ctx->stream.ogg.hlen < 4) {
+			if (*p == "OggS"[ctx->stream.ogg.hlen]) ctx->stream.ogg.hdr[ctx->stream.ogg.hlen++] = *p;
+			else if ((ctx->stream.ogg.hlen = (*p == 'O')) != 0) ctx->stream.ogg.hdr[0] = *p;
+			p++;
+			n--;
+			continue;
+		}
 
-			int n = read(ctx->fd, ctx->streambuf->writep, space);
-			if (n == 0) {
-				LOG_INFO("[%p] end of stream", ctx);
-				_disconnect(DISCONNECT, DISCONNECT_OK, ctx);
-			}
-			if (n > 0) {
-				_buf_inc_writep(ctx->streambuf, n);
-				ctx->stream.bytes += n;
-				LOG_SDEBUG("[%p] ctx->streambuf read %d bytes", ctx, n);
-			}
-			if (n < 0) {
-				LOG_WARN("[%p] error reading: %s", ctx, strerror(_last_error(ctx)));
-				_disconnect(DISCONNECT, REMOTE_DISCONNECT, ctx);
-			}
+		// fixed part of header then segments table
+		bytes = (ctx->stream.ogg.hlen < 27 ? 27 : 27 + ctx->stream.ogg.hdr[26]) - ctx->stream.ogg.hlen;
+		bytes = min(n, bytes);
+		memcpy(ctx->stream.ogg.hdr + ctx->stream.ogg.hlen, p, bytes);
+		ctx->stream.ogg.hlen += bytes;
+		p += bytes;
+		n -= bytes;
 
-			UNLOCK_S;
-			continue;
+		if (ctx->stream.ogg.hlen < 27 || ctx->stream.ogg.hlen < 27 + (size_t) ctx->stream.ogg.hdr[26]) continue;
 
-		} else {
+		// not a version we know, look for next page
+		if (ctx->stream.ogg.hdr[4]) ctx->stream.ogg.hlen = 0;
+		else _ogg_header(ctx);
+	}
+}
 
-			pollinfo.fd = ctx->fd;
-			pollinfo.events = POLLIN;
-			if (ctx->stream.state == SEND_HEADERS) {
-				pollinfo.events |= POLLOUT;
+/*
+ICY metadata is interleaved with audio: meta_interval bytes of audio, one
+length byte (x16) then metadata. State is kept between reads: meta_next is
+the audio left before next length byte, meta_left the metadata left to copy
+*/
+static size_t _icy_demux(u8_t *p, size_t n, struct thread_ctx_s *ctx) {
+	u8_t *audio = p, *end = p + n, *start = p;
+
+	while (p < end) {
+		size_t bytes;
+
+		if (ctx->stream.meta_next) {
+			// audio bytes, compact them if metadata has been removed
+			bytes = min(ctx->stream.meta_next, (size_t) (end - p));
+			if (audio != p) memmove(audio, p, bytes);
+			audio += bytes;
+			ctx->stream.meta_next -= bytes;
+		} else if (!ctx->stream.meta_left) {
+			// metadata length, MAX_HEADER must be more than meta max of 16 * 255
+			bytes = 1;
+			ctx->stream.meta_left = 16 * *p;
+			ctx->stream.header_len = 0;
+			if (!ctx->stream.meta_left) ctx->stream.meta_next = ctx->stream.meta_interval;
+		} else {
+			// metadata, might span multiple reads
+			bytes = min(ctx->stream.meta_left, (size_t) (end - p));
+			memcpy(ctx->stream.header + ctx->stream.header_len, p, bytes);
+			ctx->stream.meta_left -= bytes;
+			ctx->stream.header_len += bytes;
+
+			if (!ctx->stream.meta_left) {
+				*(ctx->stream.header + ctx->stream.header_len) = '\0';
+				LOG_INFO("[%p]: icy meta: len: %u\n%s", ctx, ctx->stream.header_len, ctx->stream.header);
+				ctx->stream.meta_send = true;
+				ctx->stream.meta_next = ctx->stream.meta_interval;
+				post_status(ctx, STATUS_STREAM);
 			}
 		}
 
+		p += bytes;
+	}
+
+	return audio - start;
+}
+
+/*---------------------------------------------------------------------------*/
+static void _stream_resumable(struct thread_ctx_s *ctx) {
+	char *p;
+	int status = 0;
+
+	// only a plain, complete (or ranged) response to a request we can replay
+	sscanf(ctx->stream.header, "HTTP/%*s %d", &status);
+	ctx->stream.resume.allowed = (status == 200 || status == 206) && ctx->stream.request_len &&
+								 strcasestr(ctx->stream.header, "Accept-Ranges: bytes") &&
+								 !strcasestr(ctx->stream.header, "icy-");
+
+	ctx->stream.resume.length = 0;
+	if ((p = strcasestr(ctx->stream.header, "Content-Length:")) != NULL) {
+		sscanf(p, "Content-Length:%" SCNu64, &ctx->stream.resume.length);
+	}
+
+	// server has been asked to start somewhere already
+	ctx->stream.resume.offset = 0;
+	if ((p = strcasestr(ctx->stream.request, "Range: bytes=")) != NULL) {
+		sscanf(p, "Range: bytes=%" SCNu64, &ctx->stream.resume.offset);
+	}
+}
+
+/*---------------------------------------------------------------------------*/
+static bool _stream_resume(struct thread_ctx_s *ctx) {
+	if (!ctx->stream.resume.allowed || ctx->stream.meta_interval || ctx->stream.resume.tries >= STREAM_RESUME_TRIES) {
+		return false;
+	}
+
+#if USE_SSL
+	if (ctx->ssl) {
+		SSL_free(ctx->ssl);
+		ctx->ssl = NULL;
+	}
+#endif
+	if (ctx->fd >= 0) closesocket(ctx->fd);
+	ctx->fd = ctx->stream.poll_fd = -1;
+
+	// remember where we were, as that's where we shall return
+	if (!ctx->stream.resume.tries) ctx->stream.resume.state = ctx->stream.state;
+
+	ctx->stream.deadline = gettime_ms() + (STREAM_RESUME_DELAY << ctx->stream.resume.tries);
+	ctx->stream.state = RESUME_WAIT;
+	ctx->stream.ssl_fallback = false;
+
+	LOG_WARN("[%p]: connection lost at %" PRIu64 ", resuming in %u ms (%d)", ctx, ctx->stream.bytes,
+			 STREAM_RESUME_DELAY << ctx->stream.resume.tries, ctx->stream.resume.tries + 1);
+	ctx->stream.resume.tries++;
+
+	return true;
+}
+
+/*---------------------------------------------------------------------------*/
+static void _stream_reconnect(struct thread_ctx_s *ctx) {
+	char *p = ctx->stream.request, *end = ctx->stream.request + ctx->stream.request_len - 2;
+	char range[64];
+	size_t len;
+
+	// header buffer is about to be re-used, let pending metadata go first
+	if (ctx->stream.meta_send) {
+		ctx->stream.deadline = gettime_ms() + 100;
+		return;
+	}
+
+	len = sprintf(range, "Range: bytes=%" PRIu64 "-\r\n\r\n", ctx->stream.resume.offset + ctx->stream.bytes);
+	ctx->stream.header_len = 0;
+
+	// replay original request, without its Range line if any
+	while (p < end) {
+		char *eol = strstr(p, "\r\n");
+		size_t n = eol ? eol + 2 - p : (size_t) (end - p);
+
+		if (strncasecmp(p, "Range:", 6)) {
+			memcpy(ctx->stream.header + ctx->stream.header_len, p, n);
+			ctx->stream.header_len += n;
+		}
+		p += n;
+	}
+
+	// final empty line has not been copied, range header brings it back
+	memcpy(ctx->stream.header + ctx->stream.header_len, range, len + 1);
+	ctx->stream.header_len += len;
+
+	_connect(ctx->stream.use_ssl, ctx);
+}
+
+/*---------------------------------------------------------------------------*/
+static void _stream_adapt_publish(struct thread_ctx_s *ctx) {
+	if (!ctx->config.adaptive_start) return;
+
+	// output can't take LOCK_S (decoders lock streambuf then outputbuf) so it gets a copy
+	mutex_lock(ctx->outputbuf->mutex);
+	ctx->output.adapt.streaming = ctx->stream.state > DISCONNECT;
+	ctx->output.adapt.start = ctx->stream.adapt.start;
+	ctx->output.adapt.samples = ctx->stream.adapt.samples;
+	ctx->output.adapt.gap = ctx->stream.adapt.gap;
+	ctx->output.adapt.jitter = ctx->stream.adapt.jitter;
+	ctx->output.adapt.prebuffer = ctx->stream.adapt.prebuffer;
+	mutex_unlock(ctx->outputbuf->mutex);
+}
+
+/*---------------------------------------------------------------------------*/
+static void _stream_adapt(struct thread_ctx_s *ctx) {
+	u32_t now = gettime_ms();
+
+	if (!ctx->stream.adapt.samples++) {
+		ctx->stream.adapt.start = now;
+	} else if (ctx->stream.adapt.last) {
+		u32_t gap = now - ctx->stream.adapt.last;
+		u32_t dev = gap > ctx->stream.adapt.gap ? gap - ctx->stream.adapt.gap : ctx->stream.adapt.gap - gap;
+
+		// 1/8 smoothing, like TCP's srtt and rttvar
+		ctx->stream.adapt.gap = (7 * ctx->stream.adapt.gap + gap) / 8;
+		ctx->stream.adapt.jitter = (7 * ctx->stream.adapt.jitter + dev) / 8;
+		ctx->stream.adapt.prebuffer = ctx->stream.adapt.gap + ctx->stream.adapt.z * ctx->stream.adapt.jitter;
+	}
+
+	// when streambuf is full we stop reading, so next gap is ours, not the network's
+	ctx->stream.adapt.last = _buf_space(ctx->streambuf) ? now : 0;
+	_stream_adapt_publish(ctx);
+}
+
+/*---------------------------------------------------------------------------*/
+static int _stream_read(struct thread_ctx_s *ctx, bool sock) {
+	struct buffer *buf = ctx->streambuf;
+	size_t space = _buf_space(buf), cont = min(space, _buf_cont_write(buf));
+
+#if !WIN
+	/*
+	when there is room at both ends of the ring, fill them with a single call,
+	except for SSL and ICY (metadata removal requires contiguous data)
+	*/
+	if (space > cont && (!sock || (!ctx->stream.meta_interval
+#if USE_SSL
+		&& !ctx->ssl
+#endif
+		))) {
+		struct iovec iov[2] = { { buf->writep, cont }, { buf->buf, space - cont } };
+		return readv(ctx->fd, iov, 2);
+	}
+#endif
+
+	return sock ? _recv(ctx, buf->writep, cont, 0) : read(ctx->fd, buf->writep, cont);
+}
+
+/*---------------------------------------------------------------------------*/
+static void _stream_wrote(struct thread_ctx_s *ctx, size_t n) {
+	// received data might span the wrap point, so proceed by contiguous region
+	while (n) {
+		size_t bytes = min(n, _buf_cont_write(ctx->streambuf));
+
+		n -= bytes;
+
+		// remove icy metadata in place, only audio is left at writep
+		if (ctx->stream.meta_interval) bytes = _icy_demux(ctx->streambuf->writep, bytes, ctx);
+		if (bytes) stream_ogg(ctx, bytes);
+
+		// only queued, cache's own thread does the disk write
+		cache_write(ctx->stream.cache.rec, ctx->streambuf->writep, bytes);
+
+		_buf_inc_writep(ctx->streambuf, bytes);
+		ctx->stream.bytes += bytes;
+	}
+}
+
+/*---------------------------------------------------------------------------*/
+static void stream_process(struct thread_ctx_s *ctx, short revents) {
+	size_t space;
+
+	LOCK_S;
+
+	// served from cache, all is there once LMS has the headers
+	if (ctx->stream.cache.hit && ctx->fd < 0) {
+		if (ctx->stream.sent_headers && ctx->stream.state > STREAMING_WAIT) _disconnect(DISCONNECT, DISCONNECT_OK, ctx);
 		UNLOCK_S;
+		return;
+	}
 
-		if (_poll(ctx, &pollinfo, 100)) {
+	// waiting to reconnect after a drop
+	if (ctx->stream.state == RESUME_WAIT) {
+		if ((int) (gettime_ms() - ctx->stream.deadline) >= 0) _stream_reconnect(ctx);
+		UNLOCK_S;
+		return;
+	}
 
-			LOCK_S;
+	// socket might have been closed or buffer filled since we polled
+	space = min(_buf_space(ctx->streambuf), _buf_cont_write(ctx->streambuf));
 
-			// check socket has not been closed while in poll
-			if (ctx->fd < 0) {
+	if (ctx->fd < 0 || !space || ctx->stream.state <= STREAMING_WAIT) {
+		UNLOCK_S;
+		return;
+	}
+
+	if (ctx->stream.state == CONNECTING || ctx->stream.state == TLS_HANDSHAKE) {
+		_connect_process(ctx, revents);
+		UNLOCK_S;
+		return;
+	}
+
+	if (ctx->stream.state == STREAMING_FILE) {
+		int n = _stream_read(ctx, false);
+		if (n == 0) {
+			LOG_INFO("[%p] end of stream", ctx);
+			_disconnect(DISCONNECT, DISCONNECT_OK, ctx);
+		}
+		if (n > 0) {
+			_buf_inc_writep(ctx->streambuf, n);
+			ctx->stream.bytes += n;
+			LOG_SDEBUG("[%p] ctx->streambuf read %d bytes", ctx, n);
+		}
+		if (n < 0) {
+			LOG_WARN("[%p] error reading: %s", ctx, strerror(_last_error(ctx)));
+			_disconnect(DISCONNECT, REMOTE_DISCONNECT, ctx);
+		}
+
+		UNLOCK_S;
+		return;
+	}
+
+	// header might take more than one round, SSL can also need to read
+	if (ctx->stream.state == SEND_HEADERS) {
+		if (revents && send_header(ctx)) {
+			ctx->stream.state = RECV_HEADERS;
+			ctx->stream.header_mlen = ctx->stream.header_len;
+			ctx->stream.header_len = 0;
+			ctx->stream.endtok = 0;
+		}
+		UNLOCK_S;
+		return;
+	}
+
+	if (revents & (POLLIN | POLLHUP)) {
+
+		// get response headers
+		if (ctx->stream.state == RECV_HEADERS) {
+
+			/*
+			Peek a whole chunk and only consume what belongs to the header, so
+			that body bytes stay in the socket (or SSL record) and go through
+			the normal body path (icy, ogg, threshold) once headers are parsed
+			*/
+			char *p = ctx->stream.header + ctx->stream.header_len;
+			int i, n = _recv(ctx, p, MAX_HEADER - 1 - ctx->stream.header_len, MSG_PEEK);
+
+			if (n <= 0) {
+				if (n < 0 && _last_error(ctx) == ERROR_WOULDBLOCK) {
+					UNLOCK_S;
+					return;
+				}
+				LOG_WARN("[%p] error reading headers: %s", ctx, n ? strerror(_last_error(ctx)) : "closed");
+
+				// lost again while resuming
+				if (ctx->stream.resume.tries && _stream_resume(ctx)) {
+					UNLOCK_S;
+					return;
+				}
+#if USE_SSL
+				if (!ctx->ssl && !ctx->stream.header_len) {
+					// let's restart with SSL this time and remember that server needs it
+					ctx->stream.header_len = ctx->stream.header_mlen;
+					closesocket(ctx->fd);
+					ctx->fd = ctx->stream.poll_fd = -1;
+					ssl_host_add(ctx);
+					LOG_INFO("[%p] now attempting with SSL", ctx);
+
+					ctx->stream.ssl_fallback = false;
+					_connect(true, ctx);
+					UNLOCK_S;
+					return;
+				}
+#endif
+				_disconnect(STOPPED, LOCAL_DISCONNECT, ctx);
 				UNLOCK_S;
-				continue;
+				return;
+			}
+
+			// search end of header (4 consecutive CR/LF), endtok spans chunks
+			for (i = 0; i < n && ctx->stream.endtok < 4; i++) {
+				if (ctx->stream.header_len + i && (p[i] == '\r' || p[i] == '\n')) ctx->stream.endtok++;
+				else ctx->stream.endtok = 0;
 			}
 
-			if ((pollinfo.revents & POLLOUT) && ctx->stream.state == SEND_HEADERS) {
-				if (send_header(ctx)) ctx->stream.state = RECV_HEADERS;
-				ctx->stream.header_mlen = ctx->stream.header_len;
-				ctx->stream.header_len = 0;
+			// now consume header bytes only, they are already there
+			if (_recv(ctx, p, i, 0) != i) {
+				LOG_WARN("[%p] error reading headers: %s", ctx, strerror(_last_error(ctx)));
+				_disconnect(STOPPED, LOCAL_DISCONNECT, ctx);
 				UNLOCK_S;
-				continue;
+				return;
 			}
 
-			if (pollinfo.revents & (POLLIN | POLLHUP)) {
+			ctx->stream.header_len += i;
 
-				// get response headers
-				if (ctx->stream.state == RECV_HEADERS) {
+			if (ctx->stream.endtok == 4) {
+				*(ctx->stream.header + ctx->stream.header_len) = '\0';
+				LOG_INFO("[%p]: headers: len: %d\n%s", ctx, ctx->stream.header_len, ctx->stream.header);
 
-					// read one byte at a time to catch end of header
-					char c;
+				if (!ctx->stream.resume.tries) {
+					_stream_resumable(ctx);
 
-					int n = _recv(ctx, &c, 1, 0);
-					if (n <= 0) {
-						if (n < 0 && _last_error(ctx) == ERROR_WOULDBLOCK) {
-							UNLOCK_S;
-							continue;
-						}
-						LOG_WARN("[%p] error reading headers: %s", ctx, n ? strerror(_last_error(ctx)) : "closed");
-#if USE_SSL
-						if (!ctx->ssl && !ctx->stream.header_len) {
-							int sock;
-
-							// let's restart with SSL this time
-							ctx->stream.header_len = ctx->stream.header_mlen;
-							closesocket(ctx->fd);
-							ctx->fd = -1;
-							LOG_INFO("[%p] now attempting with SSL", ctx);
-
-							// stay locked for slimproto (I know it can be long)
-							sock = connect_socket(true, ctx);
-
-							if (sock >= 0) {
-								ctx->fd = sock;
-								ctx->stream.state = SEND_HEADERS;
-								UNLOCK_S;
-								continue;
-							}
-						}
-#endif
-						_disconnect(STOPPED, LOCAL_DISCONNECT, ctx);
-						UNLOCK_S;
-						continue;
+					// only complete, plain responses are worth keeping
+					if (ctx->stream.cache.key && ctx->stream.resume.length && !strncmp(ctx->stream.header + 8, " 200 ", 5) &&
+						!strcasestr(ctx->stream.header, "icy-") && !strcasestr(ctx->stream.header, "Transfer-Encoding:") &&
+						!ctx->stream.cache.rec) {
+						ctx->stream.cache.rec = cache_create(ctx->stream.cache.key, ctx->stream.resume.length,
+															 ctx->stream.header, ctx->stream.header_len);
 					}
+					ctx->stream.state = ctx->stream.cont_wait ? STREAMING_WAIT : STREAMING_BUFFERING;
+					post_status(ctx, STATUS_STREAM);
+				} else if (strstr(ctx->stream.header, " 206 ")) {
+					// resumed, headers have already been sent to server
+					LOG_INFO("[%p]: resumed at %" PRIu64, ctx, ctx->stream.bytes);
+					ctx->stream.state = ctx->stream.resume.state;
+				} else {
+					LOG_WARN("[%p]: server can't resume", ctx);
+					_disconnect(DISCONNECT, REMOTE_DISCONNECT, ctx);
+				}
+			} else if (ctx->stream.header_len >= MAX_HEADER - 1) {
+				LOG_ERROR("[%p]: received headers too long: %u", ctx, ctx->stream.header_len);
+				_disconnect(DISCONNECT, LOCAL_DISCONNECT, ctx);
+			}
 
-					*(ctx->stream.header + ctx->stream.header_len) = c;
-					ctx->stream.header_len++;
-
-					if (ctx->stream.header_len > MAX_HEADER - 1) {
-						LOG_ERROR("[%p]: received headers too long: %u", ctx, ctx->stream.header_len);
-						_disconnect(DISCONNECT, LOCAL_DISCONNECT, ctx);
-					}
+			UNLOCK_S;
+			return;
+		}
 
-					if (ctx->stream.header_len > 1 && (c == '\r' || c == '\n')) {
-						ctx->stream.endtok++;
-						if (ctx->stream.endtok == 4) {
-							*(ctx->stream.header + ctx->stream.header_len) = '\0';
-							LOG_INFO("[%p]: headers: len: %d\n%s", ctx, ctx->stream.header_len, ctx->stream.header);
-							ctx->stream.state = ctx->stream.cont_wait ? STREAMING_WAIT : STREAMING_BUFFERING;
-							wake_controller(ctx);
-						}
-					} else {
-						ctx->stream.endtok = 0;
-					}
+		// stream body into streambuf
+		int n;
 
-					UNLOCK_S;
-					continue;
+		// with SSL, drain what has been received, not only a single record
+		do {
+			n = _stream_read(ctx, true);
+			if (n == 0) {
+				LOG_INFO("[%p]: end of stream (t:%" PRId64 ")", ctx, ctx->stream.bytes);
+				if (ctx->stream.cache.rec && ctx->stream.bytes == ctx->stream.resume.length) {
+					cache_commit(ctx->stream.cache.rec, ctx->stream.bytes);
+					ctx->stream.cache.rec = NULL;
 				}
+				// closed before announced length, try to resume
+				if (ctx->stream.bytes >= ctx->stream.resume.length || !_stream_resume(ctx)) {
+					_disconnect(DISCONNECT, DISCONNECT_OK, ctx);
+				}
+			}
+			if (n < 0 && _last_error(ctx) != ERROR_WOULDBLOCK) {
+				LOG_WARN("[%p]: error reading: %s (%d)", ctx, strerror(_last_error(ctx)), _last_error(ctx));
+				if (!_stream_resume(ctx)) _disconnect(DISCONNECT, REMOTE_DISCONNECT, ctx);
+			}
 
-				// receive icy meta data
-
-				if (ctx->stream.meta_interval && ctx->stream.meta_next == 0) {
-					if (ctx->stream.meta_left == 0) {
-						// read meta length
-						u8_t c;
-						int n = _recv(ctx, &c, 1, 0);
-						if (n <= 0) {
-							if (n < 0 && _last_error(ctx) == ERROR_WOULDBLOCK) {
-								UNLOCK_S;
-								continue;
-							}
-							LOG_WARN("[%p]: error reading icy meta: %s", ctx, n ? strerror(_last_error(ctx)) : "closed");
-							_disconnect(STOPPED, LOCAL_DISCONNECT, ctx);
-							UNLOCK_S;
-							continue;
-						}
-						ctx->stream.meta_left = 16 * c;
-						ctx->stream.header_len = 0; // amount of received meta data
-						// MAX_HEADER must be more than meta max of 16 * 255
-					}
+			if (n <= 0) break;
 
-					if (ctx->stream.meta_left) {
-						int n = _recv(ctx, ctx->stream.header + ctx->stream.header_len, ctx->stream.meta_left, 0);
-						if (n <= 0) {
-							if (n < 0 && _last_error(ctx) == ERROR_WOULDBLOCK) {
-								UNLOCK_S;
-								continue;
-							}
-							LOG_WARN("[%p]: error reading icy meta: %s", ctx, n ? strerror(_last_error(ctx)) : "closed");
-							_disconnect(STOPPED, LOCAL_DISCONNECT, ctx);
-							UNLOCK_S;
-							continue;
-						}
-						ctx->stream.meta_left -= n;
-						ctx->stream.header_len += n;
-					}
+			ctx->stream.resume.tries = 0;
 
-					if (ctx->stream.meta_left == 0) {
-						if (ctx->stream.header_len) {
-							*(ctx->stream.header + ctx->stream.header_len) = '\0';
-							LOG_INFO("[%p]: icy meta: len: %u\n%s", ctx, ctx->stream.header_len, ctx->stream.header);
-							ctx->stream.meta_send = true;
-							wake_controller(ctx);
-						}
-						ctx->stream.meta_next = ctx->stream.meta_interval;
-						UNLOCK_S;
-						continue;
-					}
+			_stream_wrote(ctx, n);
+			_stream_adapt(ctx);
 
-				// stream body into streambuf
-				} else {
-					space = min(_buf_space(ctx->streambuf), _buf_cont_write(ctx->streambuf));
+			if (ctx->stream.state == STREAMING_BUFFERING && ctx->stream.bytes > ctx->stream.threshold) {
+				ctx->stream.state = STREAMING_HTTP;
+				post_status(ctx, STATUS_STREAM);
+			}
 
-					if (ctx->stream.meta_interval) {
-						space = min(space, ctx->stream.meta_next);
-					}
+			LOG_DEBUG("[%p]: streambuf read %d bytes", ctx, n);
+#if USE_SSL
+		} while (ctx->ssl && _buf_space(ctx->streambuf));
+#else
+		} while (0);
+#endif
+	}
+	UNLOCK_S;
+}
 
-					int n = _recv(ctx, ctx->streambuf->writep, space, 0);
-					if (n == 0) {
-						LOG_INFO("[%p]: end of stream (t:%" PRId64 ")", ctx, ctx->stream.bytes);
-						_disconnect(DISCONNECT, DISCONNECT_OK, ctx);
-					}
-					if (n < 0 && _last_error(ctx) != ERROR_WOULDBLOCK) {
-						LOG_WARN("[%p]: error reading: %s (%d)", ctx, strerror(_last_error(ctx)), _last_error(ctx));
-						_disconnect(DISCONNECT, REMOTE_DISCONNECT, ctx);
-					}
+/*---------------------------------------------------------------------------*/
+static short _stream_events(struct thread_ctx_s *ctx, bool *ready, int *timeout) {
+	/*
+	It is required to use min with buf_space as it is the full space - 1,
+	otherwise, a write to full would be authorized and the write pointer
+	would wrap to the read pointer, making impossible to know if the buffer
+	is full or empty. This has the consequence, though, that the buffer can
+	never be totally full and can only wrap once the read pointer has moved
+	so it is impossible to count on having a proper multiply of any number
+	of bytes in the buffer
+	*/
+	size_t space = min(_buf_space(ctx->streambuf), _buf_cont_write(ctx->streambuf));
+
+	*ready = false;
+
+	// cache hit waits for headers to be sent (and cont)
+	if (ctx->stream.cache.hit && ctx->fd < 0 && ctx->stream.state > DISCONNECT) {
+		if (ctx->stream.sent_headers && ctx->stream.state > STREAMING_WAIT) {
+			*ready = true;
+			*timeout = 0;
+		} else if (*timeout < 0 || *timeout > 20) *timeout = 20;
+		return 0;
+	}
 
-					if (n > 0) {
-						stream_ogg(ctx, n);
-						_buf_inc_writep(ctx->streambuf, n);
-						ctx->stream.bytes += n;
-						if (ctx->stream.meta_interval) {
-							ctx->stream.meta_next -= n;
-						}
-					} else {
-						UNLOCK_S;
-						continue;
-					}
+	// connection setup (and wait before resuming) has a deadline
+	if (ctx->stream.state == CONNECTING || ctx->stream.state == TLS_HANDSHAKE || ctx->stream.state == RESUME_WAIT) {
+		int left = ctx->stream.deadline - gettime_ms();
 
-					if (ctx->stream.state == STREAMING_BUFFERING && ctx->stream.bytes > ctx->stream.threshold) {
-						ctx->stream.state = STREAMING_HTTP;
-						wake_controller(ctx);
-					}
+		if (left <= 0) {
+			*ready = true;
+			left = 0;
+		}
+		if (*timeout < 0 || *timeout > left) *timeout = left;
+		if (ctx->stream.state == RESUME_WAIT) return 0;
+		return ctx->stream.state == CONNECTING ? POLLOUT : ctx->stream.ssl_events;
+	}
+
+	if (ctx->fd < 0) return 0;
+
+	// nothing to wait for but re-check regularly (buffer space, cont received)
+	if (!space || ctx->stream.state <= STREAMING_WAIT) {
+		if (*timeout < 0 || *timeout > 100) *timeout = 100;
+		return 0;
+	}
+
+	// files can't be polled, they are always ready
+	if (ctx->stream.state == STREAMING_FILE) {
+		*ready = true;
+		*timeout = 0;
+		return 0;
+	}
+
+#if USE_SSL
+	/*
+	can't mimic exactly poll as SSL is a real pain. Even if SSL_pending returns
+	0, there might be bytes to read but when select (poll) return > 0, there might
+	be no frame available. As well select (poll) < 0 does not mean that there is
+	no data pending
+	*/
+	if (ctx->ssl && SSL_pending(ctx->ssl)) {
+		*ready = true;
+		*timeout = 0;
+	}
+#endif
+
+	if (ctx->stream.state == SEND_HEADERS) {
+#if USE_SSL
+		// SSL might need to read before it can write
+		if (ctx->ssl) return ctx->stream.ssl_events;
+#endif
+		return POLLOUT;
+	}
+
+	return POLLIN;
+}
+
+/*---------------------------------------------------------------------------*/
+static void *stream_reactor(void *arg) {
+	while (reactor.running) {
+		struct thread_ctx_s *ctx;
+		bool ready[MAX_PLAYER];
+		int i, n, timeout = -1;
+#if LINUX
+		struct epoll_event events[MAX_PLAYER + 1];
+#else
+		struct pollfd pollinfo[MAX_PLAYER];
+		struct thread_ctx_s *polled[MAX_PLAYER];
+		int count = 0;
+#endif
 
-					LOG_DEBUG("[%p]: streambuf read %d bytes", ctx, n);
+		mutex_lock(reactor.mutex);
+
+		// collect what each player is waiting for
+		for (i = 0; i < MAX_PLAYER; i++) {
+			short wanted;
+
+			ready[i] = false;
+			if ((ctx = thread_ctx[i]) == NULL || !ctx->stream_running) continue;
+
+			LOCK_S;
+			wanted = _stream_events(ctx, ready + i, &timeout);
+#if LINUX
+			/*
+			a closed fd is silently removed from epoll set so poll_fd is reset
+			by whoever closes it and we just have to (re)add it here. When nothing
+			is wanted it must leave the set as epoll always reports HUP/ERR
+			*/
+			if (!wanted && ctx->stream.poll_fd >= 0 && ctx->stream.poll_fd == ctx->fd) {
+				epoll_ctl(reactor.efd, EPOLL_CTL_DEL, ctx->fd, NULL);
+				ctx->stream.poll_fd = -1;
+			} else if (wanted && ctx->fd >= 0 && ctx->stream.state != STREAMING_FILE &&
+				(ctx->stream.poll_fd != ctx->fd || ctx->stream.poll_events != wanted)) {
+				struct epoll_event event = { 0 };
+
+				event.events = (wanted & POLLIN ? EPOLLIN : 0) | (wanted & POLLOUT ? EPOLLOUT : 0);
+				event.data.ptr = ctx;
+				if (epoll_ctl(reactor.efd, ctx->stream.poll_fd == ctx->fd ? EPOLL_CTL_MOD : EPOLL_CTL_ADD, ctx->fd, &event) < 0) {
+					LOG_ERROR("[%p]: can't update epoll set %s", ctx, strerror(errno));
 				}
+				ctx->stream.poll_fd = ctx->fd;
+				ctx->stream.poll_events = wanted;
 			}
-
+#else
+			if (wanted) {
+				pollinfo[count].fd = ctx->fd;
+				pollinfo[count].events = wanted;
+				pollinfo[count].revents = 0;
+				polled[count++] = ctx;
+			}
+#endif
 			UNLOCK_S;
+		}
+
+		mutex_unlock(reactor.mutex);
+
+#if LINUX
+		n = epoll_wait(reactor.efd, events, MAX_PLAYER + 1, timeout);
+#else
+		// no wake-up event, so new streams are detected by timeout
+		if (timeout < 0 || timeout > 100) timeout = 100;
+		if (count) n = poll(pollinfo, count, timeout);
+		else n = usleep(timeout * 1000);
+#endif
+
+		mutex_lock(reactor.mutex);
 
+		// players with data that poll can't see
+		for (i = 0; i < MAX_PLAYER; i++) {
+			if (ready[i] && (ctx = thread_ctx[i]) != NULL && ctx->stream_running) stream_process(ctx, POLLIN);
 		}
-		else {
-			LOG_SDEBUG("[%p]: poll timeout", ctx);
+
+#if LINUX
+		for (i = 0; i < n; i++) {
+			short revents;
+
+			ctx = events[i].data.ptr;
+
+			// wake-up from stream_sock or stream_end
+			if (!ctx) {
+				eventfd_t val;
+				eventfd_read(reactor.wake, &val);
+				continue;
+			}
+
+			revents = (events[i].events & EPOLLIN ? POLLIN : 0) | (events[i].events & EPOLLOUT ? POLLOUT : 0) |
+					  (events[i].events & (EPOLLHUP | EPOLLERR) ? POLLHUP : 0);
+			if (ctx->stream_running && !ready[ctx->self - 1]) stream_process(ctx, revents);
 		}
-	}
+#else
+		for (i = 0; n > 0 && i < count; i++) {
+			ctx = polled[i];
+			if (pollinfo[i].revents && ctx->stream_running && !ready[ctx->self - 1]) stream_process(ctx, pollinfo[i].revents);
+		}
+#endif
 
-#if USE_SSL
-	if (!--SSLcount) {
-		SSL_CTX_free(SSLctx);
-		SSLctx = NULL;
+		mutex_unlock(reactor.mutex);
 	}
+
+	return NULL;
+}
+
+/*---------------------------------------------------------------------------*/
+static void reactor_wake(void) {
+#if LINUX
+	eventfd_write(reactor.wake, 1);
+#endif
+}
+
+#if !WIN
+/*---------------------------------------------------------------------------*/
+static void _stream_release(u8_t *p, size_t size) {
+	uintptr_t page = sysconf(_SC_PAGESIZE);
+	uintptr_t start = ((uintptr_t) p + page - 1) & ~(page - 1), end = ((uintptr_t) p + size) & ~(page - 1);
+
+	// memory stays allocated, whole pages inside it are just dropped until next use
+	if (end > start) madvise((void*) start, end - start, MADV_DONTNEED);
+}
+
+/*---------------------------------------------------------------------------*/
+static bool _stream_map(struct thread_ctx_s *ctx) {
+	struct buffer *buf = ctx->streambuf;
+	struct stat st;
+	u8_t *map;
+
+	// only regular files that fit in ring's arithmetic
+	if (fstat(ctx->fd, &st) < 0 || !S_ISREG(st.st_mode) || !st.st_size || st.st_size >= UINT_MAX / 2) return false;
+
+	// never wraps, so nobody has to linearize data in place
+	map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, ctx->fd, 0);
+	if (map == MAP_FAILED) return false;
+	madvise(map, st.st_size, MADV_SEQUENTIAL);
+
+	// keep the ring aside and give its pages back while the mapping is used
+	ctx->stream.map.buf = buf->buf;
+	ctx->stream.map.size = buf->size;
+	ctx->stream.map.len = st.st_size;
+	_stream_release(buf->buf, buf->size);
+
+	// mapping is a full, non-wrapping (and read-only, base_size = 0) buffer
+	buf->buf = buf->readp = map;
+	buf->writep = map + st.st_size;
+	buf->size = st.st_size + 1;
+	buf->base_size = 0;
+	buf->wrap = buf->buf + buf->size;
+
+	return true;
+}
 #endif
 
-	return 0;
+/*---------------------------------------------------------------------------*/
+static void _stream_unmap(struct thread_ctx_s *ctx) {
+#if !WIN
+	struct buffer *buf = ctx->streambuf;
+
+	if (!ctx->stream.map.len) return;
+
+	munmap(buf->buf, ctx->stream.map.len);
+	ctx->stream.map.len = 0;
+
+	buf->buf = buf->readp = buf->writep = ctx->stream.map.buf;
+	buf->size = buf->base_size = ctx->stream.map.size;
+	buf->wrap = buf->buf + buf->size;
+#endif
 }
 
 /*---------------------------------------------------------------------------*/
 void stream_init(void) {
+	pthread_attr_t attr;
+
+	mutex_create(reactor.mutex);
+#if USE_SSL
+	mutex_create(SSLcache.mutex);
+#endif
+#if LINUX
+	struct epoll_event event = { 0 };
+
+	reactor.efd = epoll_create1(0);
+	reactor.wake = eventfd(0, EFD_NONBLOCK);
+	event.events = EPOLLIN;
+	event.data.ptr = NULL;
+	epoll_ctl(reactor.efd, EPOLL_CTL_ADD, reactor.wake, &event);
+#endif
+
+	reactor.running = true;
+	pthread_attr_init(&attr);
+	pthread_attr_setstacksize(&attr, PTHREAD_STACK_MIN + STREAM_THREAD_STACK_SIZE);
+	pthread_create(&reactor.thread, &attr, stream_reactor, NULL);
+	pthread_attr_destroy(&attr);
+
 #if USE_LIBOGG && !LINKALL
 	go.handle = dlopen(LIBOGG, RTLD_NOW);
 	if (!go.handle) {
@@ -592,6 +1351,18 @@ void stream_init(void) {
 
 /*---------------------------------------------------------------------------*/
 void stream_end(void) {
+	reactor.running = false;
+	reactor_wake();
+	pthread_join(reactor.thread, NULL);
+#if LINUX
+	close(reactor.wake);
+	close(reactor.efd);
+#endif
+	mutex_destroy(reactor.mutex);
+#if USE_SSL
+	mutex_destroy(SSLcache.mutex);
+#endif
+
 #if USE_LIBOGG && !LINKALL
 	if (go.handle) dl_close(go.Handle);
 #endif
@@ -599,9 +1370,6 @@ void stream_end(void) {
 
 /*---------------------------------------------------------------------------*/
 bool stream_thread_init(unsigned streambuf_size, struct thread_ctx_s *ctx) {
-
-	pthread_attr_t attr;
-
 	LOG_DEBUG("[%p]: streambuf size: %u", ctx, streambuf_size);
 	ctx->streambuf = &ctx->__s_buf;
 
@@ -614,39 +1382,68 @@ bool stream_thread_init(unsigned streambuf_size, struct thread_ctx_s *ctx) {
 #if USE_SSL
 	if (!SSLctx) {
 		SSLctx = SSL_CTX_new(SSLv23_client_method());
-		if (SSLctx) SSL_CTX_set_options(SSLctx, SSL_OP_NO_SSLv2);
+		if (SSLctx) {
+			SSL_CTX_set_options(SSLctx, SSL_OP_NO_SSLv2);
+			// sessions are only stored in our own per-server cache
+			SSL_CTX_set_session_cache_mode(SSLctx, SSL_SESS_CACHE_CLIENT | SSL_SESS_CACHE_NO_INTERNAL_STORE);
+			SSL_CTX_sess_set_new_cb(SSLctx, ssl_new_session);
+		}
+		if (SSLkey < 0) SSLkey = SSL_get_ex_new_index(0, NULL, NULL, NULL, ssl_key_free);
 	}
 	SSLcount++;
 	ctx->ssl = NULL;
 #endif
 
-	ctx->stream_running = true;
 	ctx->stream.state = STOPPED;
 	ctx->stream.header = malloc(MAX_HEADER);
 	ctx->stream.header[0] = '\0';
-	ctx->fd = -1;
+	ctx->stream.request = malloc(MAX_HEADER);
+	ctx->stream.request_len = 0;
+	ctx->fd = ctx->stream.poll_fd = -1;
+	ctx->stream.cache.rec = NULL;
 
 	touch_memory(ctx->streambuf->buf, ctx->streambuf->size);
 
-	pthread_attr_init(&attr);
-	pthread_attr_setstacksize(&attr, PTHREAD_STACK_MIN + STREAM_THREAD_STACK_SIZE);
-	pthread_create(&ctx->stream_thread, &attr, (void *(*)(void*)) stream_thread, ctx);
-	pthread_attr_destroy(&attr);
+	// from now on, reactor serves that player
+	mutex_lock(reactor.mutex);
+	ctx->stream_running = true;
+	mutex_unlock(reactor.mutex);
 
 	return true;
 }
 
 void stream_close(struct thread_ctx_s *ctx) {
 	LOG_INFO("[%p]: close stream", ctx);
-	LOCK_S;
+
+	// once we have the reactor's lock, it's not using that player anymore
+	mutex_lock(reactor.mutex);
 	ctx->stream_running = false;
+	mutex_unlock(reactor.mutex);
+
+#if USE_SSL
+	if (!--SSLcount) {
+		ssl_cache_flush();
+		SSL_CTX_free(SSLctx);
+		SSLctx = NULL;
+	}
+#endif
+
+	LOCK_S;
+	_stream_unmap(ctx);
+	_stream_uncache(ctx);
 	UNLOCK_S;
-	pthread_join(ctx->stream_thread, NULL);
+
 	free(ctx->stream.header);
+	free(ctx->stream.request);
 	buf_destroy(ctx->streambuf);
 }
 
+/*---------------------------------------------------------------------------*/
 void stream_file(const char *header, size_t header_len, unsigned threshold, struct thread_ctx_s *ctx) {
+	LOCK_S;
+	_stream_unmap(ctx);
+	UNLOCK_S;
+
 	buf_flush(ctx->streambuf);
 
 	LOCK_S;
@@ -655,6 +1452,22 @@ void stream_file(const char *header, size_t header_len, unsigned threshold, stru
 	memcpy(ctx->stream.header, header, header_len);
 	*(ctx->stream.header+header_len) = '\0';
 
+	ctx->stream.cont_wait = false;
+	ctx->stream.meta_interval = 0;
+	ctx->stream.meta_next = 0;
+	ctx->stream.meta_left = 0;
+	ctx->stream.meta_send = false;
+	ctx->stream.sent_headers = false;
+	ctx->stream.bytes = 0;
+	ctx->stream.threshold = threshold;
+	ctx->stream.resume.allowed = false;
+	ctx->stream.resume.tries = 0;
+	memset(&ctx->stream.adapt, 0, sizeof(ctx->stream.adapt));
+	_stream_adapt_publish(ctx);
+	_stream_uncache(ctx);
+	ctx->stream.cache.key = 0;
+	ctx->stream.cache.hit = false;
+
 	LOG_INFO("[%p]: opening local file: %s", ctx, ctx->stream.header);
 
 #if WIN
@@ -667,25 +1480,34 @@ void stream_file(const char *header, size_t header_len, unsigned threshold, stru
 	if (ctx->fd < 0) {
 		LOG_WARN("[%p]: can't open file: %s", ctx, ctx->stream.header);
 		ctx->stream.state = DISCONNECT;
+#if !WIN
+	} else if (_stream_map(ctx)) {
+		// decoders read the mapping in place, so file is fully "streamed" already
+		LOG_INFO("[%p]: file mapped (%zu bytes)", ctx, ctx->stream.map.len);
+		ctx->stream.bytes = ctx->stream.map.len;
+		_disconnect(DISCONNECT, DISCONNECT_OK, ctx);
+#endif
 	}
-	wake_controller(ctx);
-
-	ctx->stream.cont_wait = false;
-	ctx->stream.meta_interval = 0;
-	ctx->stream.meta_next = 0;
-	ctx->stream.meta_left = 0;
-	ctx->stream.meta_send = false;
-	ctx->stream.sent_headers = false;
-	ctx->stream.bytes = 0;
-	ctx->stream.threshold = threshold;
+	post_status(ctx, STATUS_STREAM);
 
 	UNLOCK_S;
+
+	reactor_wake();
 }
 
 void stream_sock(u32_t ip, u16_t port, bool use_ssl, bool use_ogg, const char *header, size_t header_len, unsigned threshold, bool cont_wait, struct thread_ctx_s *ctx) {
-	int sock;
+	bool try_ssl;
 	char *p;
 
+	LOCK_S;
+	_stream_unmap(ctx);
+	UNLOCK_S;
+
+	buf_flush(ctx->streambuf);
+
+	LOCK_S;
+
+	// reactor reads these (SSL keys, reconnect) so they only change under lock
 	memset(&ctx->stream.addr, 0, sizeof(ctx->stream.addr));
 	ctx->stream.addr.sin_family = AF_INET;
 	ctx->stream.addr.sin_addr.s_addr = ip;
@@ -698,25 +1520,12 @@ void stream_sock(u32_t ip, u16_t port, bool use_ssl, bool use_ogg, const char *h
 	}
 
 	port = ntohs(port);
-	sock = connect_socket(use_ssl || port == 443, ctx);
-
-	// try one more time with plain socket
-	if (sock < 0 && port == 443 && !use_ssl) sock = connect_socket(false, ctx);
-
-	if (sock < 0) {
-		LOCK_S;
-		ctx->stream.state = DISCONNECT;
-		ctx->stream.disconnect = UNREACHABLE;
-		UNLOCK_S;
-		return;
-	}
-
-	buf_flush(ctx->streambuf);
-
-	LOCK_S;
+	try_ssl = use_ssl || port == 443;
+#if USE_SSL
+	// that server has already refused plain connection
+	if (!try_ssl) try_ssl = ssl_host_needed(ctx);
+#endif
 
-	ctx->fd = sock;
-	ctx->stream.state = SEND_HEADERS;
 	ctx->stream.cont_wait = cont_wait;
 	ctx->stream.meta_interval = 0;
 	ctx->stream.meta_next = 0;
@@ -728,6 +1537,18 @@ void stream_sock(u32_t ip, u16_t port, bool use_ssl, bool use_ogg, const char *h
 
 	LOG_INFO("[%p]: header: %s", ctx, ctx->stream.header);
 
+	// keep request to resume if connection drops
+	ctx->stream.request_len = header_len < MAX_HEADER - 64 ? header_len : 0;
+	memcpy(ctx->stream.request, header, ctx->stream.request_len);
+	*(ctx->stream.request + ctx->stream.request_len) = '\0';
+	ctx->stream.resume.allowed = false;
+	ctx->stream.resume.tries = 0;
+	memset(&ctx->stream.adapt, 0, sizeof(ctx->stream.adapt));
+
+	// gaussian tail bound of the target underrun probability
+	if (ctx->config.adaptive_start) ctx->stream.adapt.z = sqrt(-2 * log(ctx->config.adaptive_start / 1000.0));
+	_stream_adapt_publish(ctx);
+
 	ctx->stream.sent_headers = false;
 	ctx->stream.bytes = 0;
 	ctx->stream.threshold = threshold;
@@ -743,9 +1564,44 @@ void stream_sock(u32_t ip, u16_t port, bool use_ssl, bool use_ogg, const char *h
 		OG(&go, stream_init, &ctx->stream.ogg.state, -1);
 	}
 	ctx->stream.ogg.flac = false;
-	ctx->stream.ogg.serial = ULLONG_MAX;
+	ctx->stream.ogg.serial = ctx->stream.ogg.last = ULLONG_MAX;
+	ctx->stream.ogg.hlen = ctx->stream.ogg.left = 0;
+
+	// ogg metadata is extracted while streaming, so these are not cached
+	_stream_uncache(ctx);
+	ctx->stream.cache.key = use_ogg ? 0 : cache_key(ctx->stream.request);
+	ctx->stream.cache.hit = false;
+
+#if !WIN
+	if ((ctx->fd = cache_open(ctx->stream.cache.key, ctx->stream.header, &ctx->stream.header_len)) >= 0) {
+		// cached response is what LMS gets, decoders read the mapping in place
+		if (_stream_map(ctx)) {
+			LOG_INFO("[%p]: served from cache (%zu bytes)", ctx, ctx->stream.map.len);
+			ctx->stream.cache.hit = true;
+			ctx->stream.bytes = ctx->stream.map.len;
+			ctx->stream.state = cont_wait ? STREAMING_WAIT : STREAMING_BUFFERING;
+			post_status(ctx, STATUS_STREAM);
+		} else cache_miss();
+		close(ctx->fd);
+		ctx->fd = -1;
+		if (ctx->stream.cache.hit) {
+			UNLOCK_S;
+			reactor_wake();
+			return;
+		}
+		ctx->stream.header_len = header_len;
+		memcpy(ctx->stream.header, header, header_len);
+		*(ctx->stream.header+header_len) = '\0';
+	}
+#endif
+
+	// connection is done by the reactor, don't block slimproto
+	ctx->stream.ssl_fallback = try_ssl && !use_ssl;
+	_connect(try_ssl, ctx);
 
 	UNLOCK_S;
+
+	reactor_wake();
 }
 
 bool stream_disconnect(struct thread_ctx_s* ctx) {
@@ -760,10 +1616,13 @@ bool stream_disconnect(struct thread_ctx_s* ctx) {
 #endif
 	if (ctx->fd != -1) {
 		closesocket(ctx->fd);
-		ctx->fd = -1;
+		ctx->fd = ctx->stream.poll_fd = -1;
 		disc = true;
 	}
+	_stream_unmap(ctx);
+	_stream_uncache(ctx);
 	ctx->stream.state = STOPPED;
+	_stream_adapt_publish(ctx);
 	if (ctx->stream.ogg.active) {
 		OG(&go, stream_clear, &ctx->stream.ogg.state);
 		OG(&go, sync_clear, &ctx->stream.ogg.sync);
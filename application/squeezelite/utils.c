@@ -96,13 +96,17 @@ event_type wait_readwake(event_handle handles[], int timeout) {
 	}
 #else
 	if (poll(handles, 2, timeout) > 0) {
-		if (handles[0].revents) {
+		// socket might also be polled for writing, that's not something to read
+		if (handles[0].revents & (POLLIN | POLLHUP | POLLERR)) {
 			return EVENT_READ;
 		}
 		if (handles[1].revents) {
 			wake_clear(handles[1].fd);
 			return EVENT_WAKE;
 		}
+		if (handles[0].revents & POLLOUT) {
+			return EVENT_WRITE;
+		}
 	}
 	return EVENT_TIMEOUT;
 #endif
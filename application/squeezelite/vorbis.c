@@ -238,7 +238,8 @@ static decode_state vorbis_decode( struct thread_ctx_s *ctx) {
 static void vorbis_open(u8_t size, u32_t rate, u8_t chan, u8_t endianness, struct thread_ctx_s *ctx) {
 	struct vorbis *v = ctx->decode.handle;
 
-	if (!v) {
+	// take a warm file from the pool if we don't have one already
+	if (!v && (v = ctx->decode.handle = codec_pool_get(ctx->codec)) == NULL) {
 		v = ctx->decode.handle = malloc(sizeof(struct vorbis));
 		if (!v) return;
 		v->opened = false;
@@ -256,15 +257,25 @@ static void vorbis_open(u8_t size, u32_t rate, u8_t chan, u8_t endianness, struc
 	}
 }
 
+static void vorbis_release(void *handle) {
+	struct vorbis *v = handle;
+
+	free(v->vf);
+	free(v);
+}
+
 static void vorbis_close(struct thread_ctx_s *ctx) {
 	struct vorbis *v = ctx->decode.handle;
 
+	ctx->decode.handle = NULL;
+	if (!v) return;
+
 	if (v->opened) {
 		OV(&gv, clear, v->vf);
+		v->opened = false;
 	}
-	free(v->vf);
-	free(v);
-	ctx->decode.handle = NULL;
+
+	if (!codec_pool_put(ctx->codec, v)) vorbis_release(v);
 }
 
 static bool load_vorbis(void) {
@@ -309,12 +320,10 @@ struct codec *register_vorbis(void) {
 		vorbis_open,  // open
 		vorbis_close, // close
 		vorbis_decode,// decode
+		load_vorbis,  // load
+		vorbis_release, // release
 	};
 
-	if (!load_vorbis()) {
-		return NULL;
-	}
-
 	LOG_INFO("using vorbis to decode ogg", NULL);
 	return &ret;
 }
@@ -322,5 +331,6 @@ struct codec *register_vorbis(void) {
 void deregister_vorbis(void) {
 #if !LINKALL
 	if (gv.handle) dlclose(gv.handle);
+	gv.handle = NULL;
 #endif
 }
\ No newline at end of file